@@ -19,8 +19,10 @@ void init();
 #endif
 
 // Bitboard本体クラス
+// 25升なのでu32ひとつに収まる。SIMDは使わないので、アラインメントは強制せずに4バイトのままにしておく。
+// (StateInfoやPositionに多数持たせるので、16バイトにアラインするとその分キャッシュを無駄に消費する)
 
-struct alignas(16) Bitboard {
+struct Bitboard {
   u32 p;
 
   Bitboard &operator=(const Bitboard &rhs) {
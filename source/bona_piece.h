@@ -0,0 +1,80 @@
+#ifndef _BONA_PIECE_H_
+#define _BONA_PIECE_H_
+
+#include "types.h"
+
+// 差分計算する評価関数(NNUE, KPP)で共通して用いる、駒の番号付けと変化した駒の記録
+namespace Eval {
+
+// BonaPiece : 玉以外の駒の盤上の位置と、手駒の枚数を、ある視点(先手玉側/後手玉側)から見て番号付けしたもの。
+//   [0, 20)   : 手駒。 [自分/相手][歩,銀,角,飛,金][1枚目/2枚目]
+//   [20, 470) : 盤上の駒。 [自分/相手][歩,銀,角,飛,金,と,成銀,馬,龍][升]
+// 後手視点では、盤面を180度回転させて自分と相手を入れ替えたものとして番号を付ける。
+// 玉以外の駒はちょうど10枚なので、1つの局面は常に10個のBonaPieceで表される。
+enum BonaPiece : int32_t {
+  BONA_PIECE_ZERO = 0,
+  F_HAND = 0,
+  F_BOARD = 20,
+  FE_END = F_BOARD + 18 * SQ_NB,
+};
+
+// 1つの局面を表すBonaPieceの数
+constexpr int PIECE_LIST_NB = 10;
+
+// 先手視点と後手視点のBonaPieceの組
+struct ExtBonaPiece {
+  BonaPiece fb; // 先手視点
+  BonaPiece fw; // 後手視点
+
+  BonaPiece from(Color c) const { return c == BLACK ? fb : fw; }
+};
+
+// 盤上の駒の種類を、BonaPieceで用いる番号に変換するテーブル。玉と未使用の駒は-1。
+inline constexpr int BonaKindIndex[PIECE_WHITE] = {
+  -1, 0, -1, -1, 1, 2, 3, 4, -1, 5, -1, -1, 6, 7, 8, -1,
+};
+
+// 手駒の種類を、BonaPieceで用いる番号に変換するテーブル
+inline constexpr int BonaHandIndex[PIECE_HAND_NB] = {-1, 0, -1, -1, 1, 2, 3, 4};
+
+// 盤上のsqにある駒pc(玉以外)のBonaPiece
+inline ExtBonaPiece bona_piece(Piece pc, Square sq) {
+  ASSERT_LV3(BonaKindIndex[type_of(pc)] >= 0);
+
+  const int kind = BonaKindIndex[type_of(pc)];
+  const int black_side = color_of(pc) == BLACK ? 0 : 1;
+
+  ExtBonaPiece bp;
+  bp.fb = BonaPiece(F_BOARD + ((black_side * 9) + kind) * SQ_NB + sq);
+  bp.fw = BonaPiece(F_BOARD + (((1 - black_side) * 9) + kind) * SQ_NB + Inv(sq));
+  return bp;
+}
+
+// c側の手駒のprのcount枚目(1～2)のBonaPiece
+inline ExtBonaPiece bona_piece_hand(Color c, Piece pr, int count) {
+  ASSERT_LV3(BonaHandIndex[pr] >= 0 && 1 <= count && count <= 2);
+
+  const int black_side = c == BLACK ? 0 : 1;
+
+  ExtBonaPiece bp;
+  bp.fb = BonaPiece(F_HAND + (black_side * 5 + BonaHandIndex[pr]) * 2 + count - 1);
+  bp.fw = BonaPiece(F_HAND + ((1 - black_side) * 5 + BonaHandIndex[pr]) * 2 + count - 1);
+  return bp;
+}
+
+// do_move()で変化した駒。StateInfoに持たせて、評価関数の差分計算に用いる。
+struct DirtyPiece {
+  // 変化した駒の数(玉を除く)。最大で2(移動した駒と捕獲された駒)
+  int dirty_num;
+
+  // 変化前と変化後のBonaPiece
+  ExtBonaPiece old_piece[2];
+  ExtBonaPiece new_piece[2];
+
+  // 玉が移動したか。移動した側の視点では特徴量がすべて変わるので全計算する。
+  bool king_moved[COLOR_NB];
+};
+
+} // namespace Eval
+
+#endif // _BONA_PIECE_H_
@@ -74,6 +74,66 @@
 // 置換表のデフォルトサイズ[MB]
 #define DEFAULT_TT_SIZE 64
 
+// --------------------
+//    探索の統計
+// --------------------
+
+// 探索スレッドごと・rootからの手数ごとに、末端nodeの数、betaカットの起き方、指し手オーダリングの当たり方、
+// 枝刈りの種類ごとの回数などを数える。"searchstats"コマンドで直前の探索の値を表示する。
+// 数える分だけ探索が遅くなるのでデフォルトでは無効。
+// #define USE_SEARCH_STATS
+
+// --------------------
+//    詰み探索設定
+// --------------------
+
+// 探索の各nodeで1手詰め判定を行うかどうか
+#define USE_MATE_1PLY
+
+// 探索の各nodeで3手詰め判定を行うかどうか(USE_MATE_1PLYが必要)
+#define USE_MATE_3PLY
+
+// 3手詰め判定の結果を保存するハッシュのエントリ数(2の累乗)
+#define MATE_HASH_ENTRY_NB (1 << 16)
+
+// --------------------
+//      利き設定
+// --------------------
+
+// 各升の先手/後手の利きの数をStateInfoに持ち、do_move()で差分更新するかどうか
+// 評価関数は速くなるが、do_move()が重くなる分と相殺されて現状の探索ではやや遅いのでデフォルトでは無効。
+// #define USE_EFFECT_BOARD
+
+// --------------------
+//    評価関数設定
+// --------------------
+
+// NNUE評価関数を組み込むかどうか。
+// 組み込んだ場合でも、USIオプションのUseNNUEがtrueで、NNUEFileの重みが読み込めたときにだけ用いる。
+// 重みファイルの形式はnnue.cppのread_parameters()を参照のこと。
+// #define EVAL_NNUE
+
+// KKP + KPP評価関数を組み込むかどうか。
+// 組み込んだ場合でも、USIオプションのUseKPPがtrueで、KPPFileのテーブルが読み込めたときにだけ用いる。
+// (UseNNUEも有効なときはNNUEが優先される)
+// #define EVAL_KPP
+
+// 差分計算をする評価関数のために、do_move()で変化した駒をStateInfoに記録する。
+#if defined(EVAL_NNUE) || defined(EVAL_KPP)
+#define USE_DIRTY_PIECE
+#endif
+
+// 評価値を局面のhash keyで引けるキャッシュ(EvalHash)に保存するかどうか
+#define USE_EVAL_HASH
+
+// EvalHashのデフォルトのサイズ[MB]。USIオプションのEvalHashで変更できる。(0ならキャッシュしない)
+#define DEFAULT_EVAL_HASH_SIZE 16
+
+// 計算したKKPEEをファイルに保存しておき、次回からはそれをメモリマップして用いるかどうか
+// 同じホストで複数のエンジンを動かすときに、テーブルの計算を省けて、メモリもページキャッシュで共有される。
+// 保存先はUSIオプションのEvalCacheDirで指定する。
+#define USE_EVAL_TABLE_CACHE
+
 // --- assertion tools
 
 // DEBUGビルドでないとassertが無効化されてしまうので無効化されないASSERT
@@ -1,23 +1,53 @@
 ﻿#include "evaluate.h"
+#include "kpp.h"
+#include "misc.h"
+#include "nnue.h"
+#include "usi.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <sstream>
 
 namespace Eval {
-// 利き評価テーブルの定義
-// [先手玉のマス][後手玉のマス][対象駒][そのマスの先手の利きの数(max2)][そのマスの後手の利きの数(max2)][駒(先後区別あり)]
-int16_t KKPEE[SQ_NB][SQ_NB][SQ_NB][3][3][PIECE_NB];
-void init() {
+// 利き評価テーブル
+// [先手玉のマス][後手玉のマス][対象駒][そのマスの先手の利きの数(max2)][そのマスの後手の利きの数(max2)][駒(PieceToIndex)]
+const int16_t (*KKPEE)[SQ_NB][SQ_NB][3][3][PIECE_INDEX_NB] = nullptr;
+
+int PieceValue[PIECE_NB];
+int HavingPieceValue[PIECE_NB];
+
+// 組み込みのパラメーター
+const EvalParams DefaultParams = {
+  {PawnValue, SilverValue, BishopValue, RookValue, GoldValue, KingValue,
+   ProPawnValue, ProSilverValue, HorseValue, DragonValue},
+  {HavingPawnValue, HavingSilverValue, HavingBishopValue, HavingRookValue, HavingGoldValue},
+  {our_effect_value[0], our_effect_value[1], our_effect_value[2], our_effect_value[3], our_effect_value[4]},
+  {their_effect_value[0], their_effect_value[1], their_effect_value[2], their_effect_value[3], their_effect_value[4]},
   // 利きが1つの升にm個ある時に、our_effect_value(their_effect_value)の価値は何倍されるのか？
-  // 利きは最大で10個のことがある。格納されている値は1024を1.0とみなす固定小数。
   // optimizerの答えは、{ 0 , 1024/* == 1.0 */ , 1800, 2300 , 2900,3500,3900,4300,4650,5000,5300 }
   //   6365 - pow(0.8525,m-1)*5341 　みたいな感じ？
-  int multi_effect_value[11];
+  // 利きの数は2以上を同一視するので、この式のm = 0, 1, 2の値だけを持つ。
+  {0, 1024, 1811},
+  104,
+};
 
-  // 利きがm個ある時に、our_effect_value(their_effect_value)の価値は何倍されるのか？
-  // 利きは最大で10個のことがある。
-  for (int m = 0; m < 11; ++m)
-  multi_effect_value[m] = m == 0 ? 0 : int(6365 - std::pow(0.8525, m - 1) * 5341);
-  
+EvalParams Params;
+
+namespace {
+
+// このプロセスで計算したKKPEE。キャッシュファイルをメモリマップできたときは解放する。
+struct KKPEEBuffer {
+  KKPEETable table;
+};
+std::unique_ptr<KKPEEBuffer> kkpee_buffer;
+
+// paramsからKKPEEを計算してtableに書き込む。PieceValueは計算済みであること。
+void build_kkpee(const EvalParams &params, KKPEETable &table) {
   // 利きを評価するテーブル
-  //    [自玉の位置][対象となる升][利きの数(0～10)]
+  //    [自玉の位置][対象となる升][利きの数(0～2)]
   double our_effect_table  [SQ_NB][SQ_NB][3];
   double their_effect_table[SQ_NB][SQ_NB][3];
   
@@ -27,8 +57,9 @@ void init() {
         // 筋と段でたくさん離れているほうの数をその距離とする。
         int d = dist(sq, king_sq);
         
-        our_effect_table  [king_sq][sq][m] = double(multi_effect_value[m] * our_effect_value  [d]) / (1024 * 1024);
-        their_effect_table[king_sq][sq][m] = double(multi_effect_value[m] * their_effect_value[d]) / (1024 * 1024);
+        // int同士の積はオーバーフローしうるので、doubleで計算する。
+        our_effect_table  [king_sq][sq][m] = double(params.multi_effect_value[m]) * params.our_effect_value  [d] / (1024 * 1024);
+        their_effect_table[king_sq][sq][m] = double(params.multi_effect_value[m]) * params.their_effect_value[d] / (1024 * 1024);
       }
   
   // ある升の利きの価値のテーブルの初期化
@@ -37,7 +68,8 @@ void init() {
       for (auto sq : SQ)
         for(int m1 = 0 ; m1<=2 ; ++m1) // 先手の利きの数
           for (int m2 = 0 ; m2 <=2 ; ++m2) // 後手の利きの数
-            for (Piece pc = NO_PIECE ; pc < PIECE_NB ; ++pc) { // 対象駒(先後区別あり)
+            for (int pi = 0 ; pi < PIECE_INDEX_NB ; ++pi) { // 対象駒(先後区別あり)
+              const Piece pc = IndexToPiece[pi];
               int score = 0;
               score += our_effect_table  [    king_black ][    sq ][m1];
               score -= their_effect_table[    king_black ][    sq ][m2];
@@ -47,100 +79,291 @@ void init() {
               if(pc != NO_PIECE) {
                 // 盤上の駒に対しては、その価値を1/10ほど減ずる。
                 auto piece_value = PieceValue[pc];
-                score -= piece_value * 104 / 1024;
+                score -= piece_value * params.piece_discount / 1024;
               }
 
-              KKPEE[king_black][king_white][sq][m1][m2][pc] = int16_t(score);
+              // パラメーターがparams_in_range()の範囲内であれば、int16_tに収まる。
+              ASSERT_LV3(INT16_MIN <= score && score <= INT16_MAX);
+              table[king_black][king_white][sq][m1][m2][pi] = int16_t(score);
             }
 }
-int PieceValue[PIECE_NB] = {
-  0,
-  PawnValue,
-  0,
-  0,
-  SilverValue,
-  BishopValue,
-  RookValue,
-  GoldValue,
-  KingValue,
-  ProPawnValue,
-  0,
-  0,
-  ProSilverValue,
-  HorseValue,
-  DragonValue,
-  0,
-  
-  0,
-  -PawnValue,
-  0,
-  0,
-  -SilverValue,
-  -BishopValue,
-  -RookValue,
-  -GoldValue,
-  -KingValue,
-  -ProPawnValue,
-  0,
-  0,
-  -ProSilverValue,
-  -HorseValue,
-  -DragonValue,
-  0,
+
+#if defined(USE_EVAL_TABLE_CACHE)
+
+// ----------------------------------
+//      KKPEEのキャッシュファイル
+// ----------------------------------
+
+// キャッシュファイルの識別子とバージョン
+// build_kkpee()の計算方法を変えたときは、古いキャッシュファイルを用いないようにバージョンを上げること。
+constexpr u32 KKPEE_CACHE_MAGIC = 0x4345454b; // "KEEC"
+constexpr u32 KKPEE_CACHE_VERSION = 1;
+
+// キャッシュファイルのヘッダー : 識別子, バージョン, テーブルを生成したパラメーターのハッシュ値
+// 続けてKKPEETableをそのままの形で置く。
+struct KKPEECacheHeader {
+  u32 magic, version;
+  u64 params_hash;
 };
 
-int HavingPieceValue[PIECE_NB] = {
-  0,
-  HavingPawnValue,
-  0,
-  0,
-  HavingSilverValue,
-  HavingBishopValue,
-  HavingRookValue,
-  HavingGoldValue,
-  HavingKingValue,
-  HavingProPawnValue,
-  0,
-  0,
-  HavingProSilverValue,
-  HavingHorseValue,
-  HavingDragonValue,
-  0,
-  
-  0,
-  -HavingPawnValue,
-  0,
-  0,
-  -HavingSilverValue,
-  -HavingBishopValue,
-  -HavingRookValue,
-  -HavingGoldValue,
-  -HavingKingValue,
-  -HavingProPawnValue,
-  0,
-  0,
-  -HavingProSilverValue,
-  -HavingHorseValue,
-  -HavingDragonValue,
-  0,
+// KKPEEをメモリマップしているキャッシュファイル
+MappedFile kkpee_file;
+
+// テーブルを生成したパラメーターとテーブルの形のハッシュ値(FNV-1a 64bit)
+u64 kkpee_params_hash(const EvalParams &params) {
+  u64 h = 14695981039346656037ull;
+  auto add = [&](u32 v) {
+    h ^= v;
+    h *= 1099511628211ull;
+  };
+  add(KKPEE_CACHE_VERSION);
+  add(SQ_NB);
+  add(PIECE_INDEX_NB);
+  for (size_t i = 0; i < sizeof(EvalParams) / sizeof(int32_t); ++i)
+    add(u32(((const int32_t *)&params)[i]));
+  return h;
+}
+
+// パラメーターのハッシュ値ごとにファイルを分けておく。
+// (パラメーターの違うエンジンを同じディレクトリで動かしても、互いのキャッシュを上書きしない)
+std::string kkpee_cache_path(const std::string &dir, u64 hash) {
+  std::ostringstream ss;
+  ss << dir << "/kkpee_" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+  return ss.str();
+}
+
+// キャッシュファイルをメモリマップしてKKPEEに設定する。ファイルがない・形式が違うときはfalseを返す。
+bool map_kkpee_cache(const std::string &path, u64 hash) {
+  kkpee_file.close();
+  if (!kkpee_file.open(path))
+    return false;
+
+  KKPEECacheHeader header;
+  bool ok = kkpee_file.size() == sizeof(header) + sizeof(KKPEETable);
+  if (ok) {
+    std::memcpy(&header, kkpee_file.data(), sizeof(header));
+    ok = header.magic == KKPEE_CACHE_MAGIC && header.version == KKPEE_CACHE_VERSION &&
+         header.params_hash == hash;
+  }
+  if (!ok) {
+    kkpee_file.close();
+    return false;
+  }
+
+  KKPEE = (decltype(KKPEE))((const char *)kkpee_file.data() + sizeof(header));
+  return true;
+}
+
+// 計算したテーブルをキャッシュファイルに書き出す。
+// 他のプロセスが書きかけのファイルを読まないように、一時ファイルに書いてからrenameする。
+bool write_kkpee_cache(const std::string &path, u64 hash, const KKPEETable &table) {
+  PRNG prng;
+  std::ostringstream tmp;
+  tmp << path << "." << std::hex << prng.rand<u64>() << ".tmp";
+
+  {
+    std::ofstream ofs(tmp.str(), std::ios::binary);
+    const KKPEECacheHeader header = {KKPEE_CACHE_MAGIC, KKPEE_CACHE_VERSION, hash};
+    ofs.write((const char *)&header, sizeof(header));
+    ofs.write((const char *)&table, sizeof(table));
+    if (!ofs) {
+      ofs.close();
+      std::remove(tmp.str().c_str());
+      return false;
+    }
+  }
+
+  if (std::rename(tmp.str().c_str(), path.c_str()) != 0) {
+    std::remove(tmp.str().c_str());
+    return false;
+  }
+  return true;
+}
+
+#endif // defined(USE_EVAL_TABLE_CACHE)
+
+} // namespace
+
+void apply_params(const EvalParams &params) {
+  Params = params;
+
+  // 駒の価値のテーブル(後手の駒は負の値)
+  std::fill(std::begin(PieceValue), std::end(PieceValue), 0);
+  std::fill(std::begin(HavingPieceValue), std::end(HavingPieceValue), 0);
+  for (int i = 0; i < PARAM_PIECE_NB; ++i) {
+    PieceValue[ParamPieces[i]] = params.piece_value[i];
+    PieceValue[make_piece(WHITE, ParamPieces[i])] = -params.piece_value[i];
+  }
+  for (int i = 0; i < PARAM_HAND_NB; ++i) {
+    HavingPieceValue[ParamHandPieces[i]] = params.having_value[i];
+    HavingPieceValue[make_piece(WHITE, ParamHandPieces[i])] = -params.having_value[i];
+  }
+
+#if defined(USE_EVAL_TABLE_CACHE)
+  // 同じパラメーターで計算したキャッシュファイルがあれば、計算せずにそれをメモリマップする。
+  // 読み取り専用でマップするので、同じファイルを用いるプロセスの間で物理メモリが共有される。
+  const std::string dir = Options["EvalCacheDir"];
+  const u64 hash = kkpee_params_hash(params);
+  const std::string path = dir == "<none>" ? "" : kkpee_cache_path(dir, hash);
+  if (!path.empty() && map_kkpee_cache(path, hash)) {
+    kkpee_buffer.reset();
+    return;
+  }
+#endif
+
+  if (!kkpee_buffer)
+    kkpee_buffer = std::make_unique<KKPEEBuffer>();
+  build_kkpee(params, kkpee_buffer->table);
+  KKPEE = kkpee_buffer->table;
+
+#if defined(USE_EVAL_TABLE_CACHE)
+  // 書き出したファイルをマップし直して、次に起動するプロセスとページを共有する。
+  if (!path.empty() && write_kkpee_cache(path, hash, kkpee_buffer->table) &&
+      map_kkpee_cache(path, hash))
+    kkpee_buffer.reset();
+#endif
+}
+
+// KKPEEの計算とEvalHashの確保は時間がかかるので、起動時ではなくisreadyのときに
+// load_eval()とresize_eval_hash()で行う。
+void init() {
+}
+
+// ----------------------------------
+//      パラメーターファイル
+// ----------------------------------
+
+namespace {
+
+// パラメーターファイルの識別子とバージョン
+constexpr u32 PARAMS_FILE_MAGIC = 0x35505645; // "EVP5"
+constexpr u32 PARAMS_FILE_VERSION = 1;
+
+// パラメーターの数
+constexpr u32 PARAMS_COUNT = sizeof(EvalParams) / sizeof(int32_t);
+
+// パラメーターのチェックサム(FNV-1a)。ファイルの破損を検出するためのもの。
+u32 params_checksum(const int32_t *p, size_t n) {
+  u32 h = 2166136261u;
+  for (size_t i = 0; i < n; ++i) {
+    h ^= u32(p[i]);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// パラメーターファイルのヘッダー : 識別子, バージョン, パラメーターの数, チェックサム
+// 続けてEvalParamsの各メンバーを宣言順にint32_t(little endian)で並べたもの。余分なデータはないこと。
+struct ParamsHeader {
+  u32 magic, version, count, checksum;
 };
 
-Value evaluate(const Position &pos) {
+// KKPEEがint16_tに収まるように、パラメーターの値の範囲を制限しておく。
+// (範囲はevaluate.hのMAX_*を参照)
+bool params_in_range(const EvalParams &params) {
+  for (auto v : params.piece_value)
+    if (v < 0 || v > MAX_PIECE_VALUE)
+      return false;
+  for (auto v : params.having_value)
+    if (v < 0 || v > MAX_PIECE_VALUE)
+      return false;
+  for (int d = 0; d < 5; ++d)
+    if (params.our_effect_value[d] < 0 || params.our_effect_value[d] > MAX_EFFECT_VALUE ||
+        params.their_effect_value[d] < 0 || params.their_effect_value[d] > MAX_EFFECT_VALUE)
+      return false;
+  for (auto v : params.multi_effect_value)
+    if (v < 0 || v > MAX_MULTI_EFFECT_VALUE)
+      return false;
+  return 0 <= params.piece_discount && params.piece_discount <= MAX_PIECE_DISCOUNT;
+}
+
+} // namespace
+
+bool read_params(const std::string &filename, EvalParams &params) {
+  static_assert(sizeof(EvalParams) == PARAMS_COUNT * sizeof(int32_t), "");
+
+  MappedFile file;
+  if (!file.open(filename))
+    return false;
+
+  if (file.size() != sizeof(ParamsHeader) + sizeof(EvalParams))
+    return false;
+
+  ParamsHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (header.magic != PARAMS_FILE_MAGIC || header.version != PARAMS_FILE_VERSION ||
+      header.count != PARAMS_COUNT)
+    return false;
+
+  EvalParams p;
+  std::memcpy(&p, (const char *)file.data() + sizeof(header), sizeof(p));
+  if (header.checksum != params_checksum((const int32_t *)&p, PARAMS_COUNT) || !params_in_range(p))
+    return false;
+
+  params = p;
+  return true;
+}
+
+bool write_params(const std::string &filename, const EvalParams &params) {
+  if (!params_in_range(params))
+    return false;
+
+  std::ofstream ofs(filename, std::ios::binary);
+  const ParamsHeader header = {PARAMS_FILE_MAGIC, PARAMS_FILE_VERSION, PARAMS_COUNT,
+                               params_checksum((const int32_t *)&params, PARAMS_COUNT)};
+  ofs.write((const char *)&header, sizeof(header));
+  ofs.write((const char *)&params, sizeof(params));
+  return bool(ofs);
+}
+
+void load_eval() {
+  const std::string filename = Options["EvalFile"];
+  EvalParams params = DefaultParams;
+  if (filename != "<internal>") {
+    if (read_params(filename, params))
+      std::cout << "info string EvalFile " << filename << " loaded." << std::endl;
+    else {
+      std::cout << "info string Error! failed to load EvalFile " << filename
+                << ". Use the built-in parameters instead." << std::endl;
+      params = DefaultParams;
+    }
+  }
+
+  // テーブルの再計算は時間がかかるので、パラメーターが変わったときだけ行う。
+  if (std::memcmp(&params, &Params, sizeof(params)) != 0)
+    apply_params(params);
+}
+
+Value compute_eval(const Position &pos) {
+#if defined(EVAL_NNUE)
+  if (NNUE::enabled)
+    return NNUE::evaluate(pos);
+#endif
+#if defined(EVAL_KPP)
+  if (KPP::enabled)
+    return KPP::evaluate(pos);
+#endif
+
   Value score = VALUE_ZERO;
-  const Bitboard oc = pos.pieces();
-  
+
+  // 先手・後手それぞれの利きの数(max2)を盤面全体について先に求めておく。
+  Bitboard one[COLOR_NB], two[COLOR_NB];
+  effect_count_bb(pos, BLACK, one[BLACK], two[BLACK]);
+  effect_count_bb(pos, WHITE, one[WHITE], two[WHITE]);
+
+  // 玉の位置は固定なので、参照するテーブルの範囲をループの外で求めておく。
+  const auto &kkpee = KKPEE[pos.king_square(BLACK)][pos.king_square(WHITE)];
+
   // 25ループ
   for (const Square &sq : SQ) {
     // 盤上の駒の評価
     score += PieceValue[pos.piece_on(sq)];
   // 利きの評価
   // enum Square: int32_t
-  score += KKPEE[pos.king_square(BLACK)]
-                [pos.king_square(WHITE)]
-                [sq]
-                [fast_effect_count(pos.attackers_to(BLACK, sq, oc))]
-                [fast_effect_count(pos.attackers_to(WHITE, sq, oc))]
-                [pos.piece_on(sq)];
+  score += kkpee[sq]
+                [((one[BLACK].p >> sq) & 1) + ((two[BLACK].p >> sq) & 1)]
+                [((one[WHITE].p >> sq) & 1) + ((two[WHITE].p >> sq) & 1)]
+                [PieceToIndex[pos.piece_on(sq)]];
 }
   
   // 手駒の評価
@@ -159,4 +382,145 @@ Value evaluate(const Position &pos) {
   // 手番側から見た評価値を返す
   return pos.side_to_move() == BLACK ? score : -score;
 }
+
+// ----------------------------------
+//      EvalHash
+// ----------------------------------
+
+namespace {
+
+#if defined(USE_EVAL_HASH)
+// 1エントリを64bitに詰める。
+//   bit 0..31  : 評価値(手番側から見たもの)
+//   bit 32     : 1(有効なエントリ)
+//   bit 33..63 : 局面のhash keyの上位31bit
+// 手番はhash keyに含まれているので、手番側から見た評価値をそのまま保存してよい。
+// 0クリアしたエントリはbit 32が0なので、どの局面にもヒットしない。
+std::unique_ptr<std::atomic<u64>[]> eval_hash;
+u64 eval_hash_mask = 0;
+
+// キャッシュを用いるか。サイズが0のときと、キャッシュを引くほうが遅い評価関数のときはfalse。
+bool eval_hash_enabled = false;
+
+#if defined(USE_SEARCH_STATS)
+// 統計。全スレッドが毎回同じキャッシュラインに書き込むことになり遅いので、USE_SEARCH_STATSのときだけ数える。
+// ロックを伴う加算はさらに重いので、複数スレッドから更新したときに多少取りこぼすのは許容する。
+std::atomic<u64> eval_hash_probes{0};
+std::atomic<u64> eval_hash_hits{0};
+
+inline void increment(std::atomic<u64> &counter) {
+  counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+#define EVAL_HASH_STATS(X) X
+#else
+#define EVAL_HASH_STATS(X)
+#endif
+
+inline std::atomic<u64> &eval_hash_entry(Key key) { return eval_hash[key & eval_hash_mask]; }
+
+// エントリのbit 32..63に格納する値(有効ビットとhash keyの上位31bit)
+inline u64 eval_hash_check(Key key) { return (key & 0xfffffffe00000000ULL) | (1ULL << 32); }
+#endif
+
+} // namespace
+
+Value evaluate(const Position &pos) {
+#if defined(USE_EVAL_HASH)
+  if (eval_hash_enabled) {
+    const Key key = pos.key();
+    std::atomic<u64> &entry = eval_hash_entry(key);
+    const u64 data = entry.load(std::memory_order_relaxed);
+    EVAL_HASH_STATS(increment(eval_hash_probes));
+    if ((data & 0xffffffff00000000ULL) == eval_hash_check(key)) {
+      EVAL_HASH_STATS(increment(eval_hash_hits));
+      return Value(int32_t(u32(data)));
+    }
+
+    const Value v = compute_eval(pos);
+    entry.store(eval_hash_check(key) | u32(int32_t(v)), std::memory_order_relaxed);
+    return v;
+  }
+#endif
+  return compute_eval(pos);
+}
+
+void resize_eval_hash(size_t mb) {
+#if defined(USE_EVAL_HASH)
+  // エントリ数はmb[MB]に収まる最大の2の累乗
+  size_t entries = mb * 1024 * 1024 / sizeof(u64);
+  while (entries & (entries - 1))
+    entries &= entries - 1;
+
+  if (entries != eval_hash_mask + 1 || !eval_hash) {
+    eval_hash.reset();
+    eval_hash_mask = 0;
+    if (entries > 0) {
+      eval_hash = std::make_unique<std::atomic<u64>[]>(entries);
+      eval_hash_mask = entries - 1;
+    }
+  }
+
+  eval_hash_enabled = eval_hash != nullptr;
+#if defined(EVAL_KPP)
+  // KPPは差分計算済みの値を返すだけなので、キャッシュを引くほうが遅い。
+  if (KPP::enabled)
+    eval_hash_enabled = false;
+#endif
+#if defined(EVAL_NNUE)
+  // NNUEはどちらにしてもKPPより優先されるので、キャッシュを用いる。
+  if (NNUE::enabled)
+    eval_hash_enabled = eval_hash != nullptr;
+#endif
+
+  clear_eval_hash();
+#endif
+}
+
+void clear_eval_hash() {
+#if defined(USE_EVAL_HASH)
+  if (eval_hash)
+    for (u64 i = 0; i <= eval_hash_mask; ++i)
+      eval_hash[i].store(0, std::memory_order_relaxed);
+#endif
+}
+
+void prefetch_eval_hash(Key key) {
+#if defined(USE_EVAL_HASH)
+  if (eval_hash_enabled) {
+#if defined(_MSC_VER)
+    _mm_prefetch((const char *)&eval_hash_entry(key), _MM_HINT_T0);
+#else
+    __builtin_prefetch(&eval_hash_entry(key));
+#endif
+  }
+#endif
+}
+
+Value probe_eval_hash(const Position &pos) {
+#if defined(USE_EVAL_HASH)
+  if (eval_hash_enabled) {
+    const Key key = pos.key();
+    const u64 data = eval_hash_entry(key).load(std::memory_order_relaxed);
+    if ((data & 0xffffffff00000000ULL) == eval_hash_check(key))
+      return Value(int32_t(u32(data)));
+  }
+#endif
+  return VALUE_NONE;
+}
+
+EvalHashStats eval_hash_stats() {
+#if defined(USE_EVAL_HASH) && defined(USE_SEARCH_STATS)
+  return {eval_hash_probes.load(std::memory_order_relaxed), eval_hash_hits.load(std::memory_order_relaxed)};
+#else
+  return {0, 0};
+#endif
+}
+
+void reset_eval_hash_stats() {
+#if defined(USE_EVAL_HASH) && defined(USE_SEARCH_STATS)
+  eval_hash_probes = 0;
+  eval_hash_hits = 0;
+#endif
+}
+
 } // namespace Eval
@@ -36,7 +36,7 @@ enum {
   HavingKingValue = 0,
 };
 
-// 駒の価値のテーブル(後手の駒は負の値)
+// 駒の価値のテーブル(後手の駒は負の値)。apply_params()で設定される。
 extern int PieceValue[PIECE_NB];
 extern int HavingPieceValue[PIECE_NB];
 
@@ -55,22 +55,162 @@ inline constexpr int their_effect_value[] = {
   96 * 1024 / 5,
 };
 
+// パラメーターで価値を持つ駒
+enum { PARAM_PIECE_NB = 10, PARAM_HAND_NB = 5 };
+inline constexpr Piece ParamPieces[PARAM_PIECE_NB] = {
+  PAWN, SILVER, BISHOP, ROOK, GOLD, KING, PRO_PAWN, PRO_SILVER, HORSE, DRAGON,
+};
+inline constexpr Piece ParamHandPieces[PARAM_HAND_NB] = {PAWN, SILVER, BISHOP, ROOK, GOLD};
+
+// 評価関数のパラメーター
+// 組み込みの値(DefaultParams)は上の駒の価値とour_effect_value/their_effect_valueなど。
+// USIオプションのEvalFileで指定したファイルから読み込んで差し替えられる。(形式はread_params()を参照)
+struct EvalParams {
+  // 盤上の駒の価値 [ParamPieces]
+  int32_t piece_value[PARAM_PIECE_NB];
+
+  // 手駒の価値 [ParamHandPieces]
+  int32_t having_value[PARAM_HAND_NB];
+
+  // 玉からの距離(0～4)ごとの、味方の利き・敵の利きの価値(評価値の1024倍)
+  int32_t our_effect_value[5];
+  int32_t their_effect_value[5];
+
+  // 1つの升にある利きの数(0, 1, 2以上)ごとの、利きの価値の倍率。1024を1.0とする固定小数。
+  int32_t multi_effect_value[3];
+
+  // 盤上の駒がある升について、その駒の価値を利きの評価から減ずる割合。1024を1.0とする固定小数。
+  int32_t piece_discount;
+};
+
+// パラメーターの値の上限(下限はどれも0)。read_params()はこの範囲外の値を受け付けない。
+// KKPEEの1エントリは、利きの項(|倍率 * 利きの価値| <= 4 * 128 = 512)が4つと、盤上の駒の価値を減ずる項の和なので
+//   4 * 512 + 30000 * 1024 / 1024 = 32048
+// に収まり、int16_tで表せる。
+enum : int32_t {
+  MAX_PIECE_VALUE = 30000,
+  MAX_EFFECT_VALUE = 128 * 1024,
+  MAX_MULTI_EFFECT_VALUE = 4 * 1024,
+  MAX_PIECE_DISCOUNT = 1024,
+};
+static_assert(4 * (int64_t(MAX_MULTI_EFFECT_VALUE) * MAX_EFFECT_VALUE / (1024 * 1024)) +
+                  int64_t(MAX_PIECE_VALUE) * MAX_PIECE_DISCOUNT / 1024 <=
+              INT16_MAX,
+              "KKPEE must fit in int16_t");
+
+extern const EvalParams DefaultParams;
+
+// 現在のパラメーター
+extern EvalParams Params;
+
+// パラメーターを設定して、PieceValue, HavingPieceValue, KKPEEを計算し直す。
+void apply_params(const EvalParams &params);
+
+// パラメーターファイルをメモリマップして読み込む。ファイルがない・形式が違う・値が範囲外のときはfalseを返す。
+bool read_params(const std::string &filename, EvalParams &params);
+
+// パラメーターをread_params()で読み込める形式で書き出す。値が範囲外のときや書き込めなかったときはfalseを返す。
+bool write_params(const std::string &filename, const EvalParams &params);
+
+// USIオプションのEvalFileのパラメーターを読み込む。isreadyのときに呼び出される。
+// "<internal>"か、読み込めなかったときは組み込みのパラメーターを用いる。
+void load_eval();
+
+// KKPEEの駒の次元に用いる、盤上に現れる駒(先後区別あり)とNO_PIECEを詰めて番号付けしたもの。
+// Pieceのままだと32通りあるが、実際に盤上に現れるのは21通りしかない。
+enum { PIECE_INDEX_NB = 21 };
+
+inline constexpr Piece IndexToPiece[PIECE_INDEX_NB] = {
+  NO_PIECE,
+  B_PAWN, B_SILVER, B_BISHOP, B_ROOK, B_GOLD, B_KING, B_PRO_PAWN, B_PRO_SILVER, B_HORSE, B_DRAGON,
+  W_PAWN, W_SILVER, W_BISHOP, W_ROOK, W_GOLD, W_KING, W_PRO_PAWN, W_PRO_SILVER, W_HORSE, W_DRAGON,
+};
+
+// PieceからKKPEEの駒の番号への変換テーブル。盤上に現れない駒は0(NO_PIECE)にしておく。
+inline constexpr uint8_t PieceToIndex[PIECE_NB] = {
+  0, 1, 0, 0, 2, 3, 4, 5, 6, 7, 0, 0, 8, 9, 10, 0,
+  0, 11, 0, 0, 12, 13, 14, 15, 16, 17, 0, 0, 18, 19, 20, 0,
+};
+
 /**
  * 機器の勝ちを合算した値を求めるテーブル
- * [先手玉のマス][後手玉のマス][対象駒][そのマスの先手の利きの数(max2)][そのマスの後手の利きの数(max2)][駒(先後区別あり)]
- * 81*81*81*3*3*size_of(int16_t)*32 = 306MB
+ * [先手玉のマス][後手玉のマス][対象駒][そのマスの先手の利きの数(max2)][そのマスの後手の利きの数(max2)][駒(PieceToIndex)]
+ * 25*25*25*3*3*21*size_of(int16_t) = 5.9MB
  * 1つの升にある利きは、2つ以上の利きは同一視。
+ * 玉の位置が決まれば、1局面の評価で参照するのはKKPEE[玉][玉](約9.3KB)の範囲だけになる。
  */
 // extern int16_t effect_table[SQ_NB][SQ_NB][SQ_NB][11][11];
-extern int16_t KKPEE[SQ_NB][SQ_NB][SQ_NB][3][3][PIECE_NB];
+using KKPEETable = int16_t[SQ_NB][SQ_NB][SQ_NB][3][3][PIECE_INDEX_NB];
+
+// KKPEE[先手玉][後手玉]...として参照する、テーブルの先頭へのポインター。
+// apply_params()で、このプロセスで計算したテーブルか、キャッシュファイルをメモリマップしたものを指すように設定される。
+extern const int16_t (*KKPEE)[SQ_NB][SQ_NB][3][3][PIECE_INDEX_NB];
 
 // ビットが0か1か2以上かを高速に判定する関数
 inline int fast_effect_count(const Bitboard &b) {
   return (b ? ((b.p & (b.p - 1)) ? 2 : 1) : 0);
 }
 
+// c側の駒の利きを盤面全体について一度に数える。
+// 各駒の利きのBitboardを、2で飽和するcarry-save adderに順に足し込んでいく。
+//   one : c側の利きが1つ以上ある升
+//   two : c側の利きが2つ以上ある升
+// ある升の利きの数(max2)は、(one & sq) + (two & sq)で求まる。
+// USE_EFFECT_BOARDのときはdo_move()で差分更新されている利きの数から求める。
+inline void effect_count_bb(const Position &pos, Color c, Bitboard &one, Bitboard &two) {
+#if defined(USE_EFFECT_BOARD)
+  pos.effect_count_bb(c, one, two);
+#else
+  const Bitboard occ = pos.pieces();
+
+  // 歩は同じ升に2枚利くことはない(二歩)ので、まとめてシフトで求めてよい。
+  one = pawnEffect(c, pos.pieces(c, PAWN));
+  two = ZERO_BB;
+
+  Bitboard bb = pos.pieces(c) & ~pos.pieces(PAWN);
+  while (bb) {
+    const Square sq = bb.pop();
+    const Bitboard effect = effects_from(pos.piece_on(sq), sq, occ);
+    two |= one & effect;
+    one |= effect;
+  }
+#endif
+}
+
+// 起動時に呼び出される。テーブルの計算はisreadyのときのload_eval()で行う。
 void init();
+
+// 手番側から見た評価値を返す。EvalHashにあればその値を返す。
 Value evaluate(const Position &pos);
+
+// 評価関数を呼び出して評価値を求める。EvalHashは用いない。
+Value compute_eval(const Position &pos);
+
+// --- EvalHash
+// 評価値のキャッシュ。局面のhash keyで引くdirect-mappedなテーブルで、lock-freeに読み書きする。
+// USE_EVAL_HASHが無効なときは、以下の関数は何もしない。
+
+// EvalHashのサイズをmb[MB]にしてクリアする。0ならキャッシュしない。
+void resize_eval_hash(size_t mb);
+
+// EvalHashをクリアする。評価関数を切り替えたときに呼び出すこと。
+void clear_eval_hash();
+
+// EvalHashの局面のhash keyがkeyのエントリをキャッシュに読み込んでおく。
+// evaluate()を呼び出すことが分かっているnodeで、早めに呼び出しておくこと。
+void prefetch_eval_hash(Key key);
+
+// EvalHashに局面posの評価値があれば返す。なければVALUE_NONE。(評価関数は呼び出さない)
+Value probe_eval_hash(const Position &pos);
+
+// EvalHashの統計(probe回数とヒット回数)。USE_SEARCH_STATSが定義されていなければ数えず、常に0。
+struct EvalHashStats {
+  u64 probes;
+  u64 hits;
+};
+EvalHashStats eval_hash_stats();
+void reset_eval_hash_stats();
+
 } // namespace Eval
 
 #endif
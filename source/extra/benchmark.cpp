@@ -0,0 +1,347 @@
+﻿#include "../types.h"
+
+// USI拡張コマンド "bench", "perft"
+// 評価関数・指し手生成の速度と、固定深さの探索の速度(nps)を計測する。
+// 高速化の効果を確認するためのもので、思考エンジンの実行には関係しない。
+
+#include <algorithm>
+#include <sstream>
+
+#include "../evaluate.h"
+#include "../misc.h"
+#include "../position.h"
+#include "../search.h"
+
+using namespace std;
+
+namespace {
+
+// 探索速度の計測に用いる局面(平手の初期局面から、このエンジン同士で指し進めたもの)
+const char *BenchSfens[] = {
+    "rbsgk/4p/5/P4/KGSBR b - 1",
+    "r1sgk/4p/5/PSG2/K3R w Bb 6",
+    "r1s1k/4p/2G2/P2b1/K3R b BGs 11",
+    "r1s1k/5/2GB1/P2b1/K4 b GPrs 15",
+};
+
+// 評価関数の計測用の局面を、ランダムプレイヤーで指し進めて集める。
+// seedを固定しているので毎回同じ局面集合になる。
+vector<string> random_sfens(size_t games, int max_ply) {
+  vector<string> sfens;
+  PRNG prng(20240601);
+  Position pos;
+
+  for (size_t g = 0; g < games; ++g) {
+    StateListPtr states(new StateList(1));
+    pos.set_hirate(&states->back());
+
+    for (int ply = 0; ply < max_ply; ++ply) {
+      MoveList<LEGAL_ALL> ml(pos);
+      if (ml.size() == 0)
+        break;
+
+      states->emplace_back();
+      pos.do_move(ml.at(prng.rand(ml.size())).move, states->back());
+      sfens.push_back(pos.sfen());
+    }
+  }
+  return sfens;
+}
+
+// pseudo-legalな指し手を生成してからlegal()で自殺手を取り除く、従来の方法での合法手の生成。
+// 合法手を直接生成するMoveList<LEGAL_ALL>の検証と、速度の比較に用いる。
+ExtMove *generate_legal_by_filter(const Position &pos, ExtMove *mlist) {
+  auto last = pos.in_check() ? generateMoves<EVASIONS_ALL>(pos, mlist)
+                             : generateMoves<NON_EVASIONS_ALL>(pos, mlist);
+  while (mlist != last) {
+    if (!pos.legal(*mlist))
+      mlist->move = (--last)->move;
+    else
+      ++mlist;
+  }
+  return last;
+}
+
+// 局面posからdepth手で到達する局面の数。Filterならgenerate_legal_by_filter()で指し手を生成する。
+template <bool Filter> u64 perft(Position &pos, int depth) {
+  ExtMove moves[MAX_MOVES];
+  ExtMove *last = Filter ? generate_legal_by_filter(pos, moves)
+                         : generateMoves<LEGAL_ALL>(pos, moves);
+  if (depth <= 1)
+    return u64(last - moves);
+
+  u64 nodes = 0;
+  StateInfo si;
+  for (ExtMove *m = moves; m != last; ++m) {
+    pos.do_move(m->move, si);
+    nodes += perft<Filter>(pos, depth - 1);
+    pos.undo_move(m->move);
+  }
+  return nodes;
+}
+
+// perft()をスレッドプール(Threading::Pool)で並列に数える。
+// 残り深さがPARALLEL_MIN_DEPTH以上の局面では、子局面ごとにPositionをコピーしてタスクに分ける。
+// 子局面のタスクがさらに分かれるので、合法手が少ない局面でもワーカーに仕事が行き渡る。
+template <bool Filter> u64 parallel_perft(const Position &pos, int depth) {
+  constexpr int PARALLEL_MIN_DEPTH = 4;
+
+  // 千日手判定用の索引は他のスレッドと共有できないので外しておく。(perftでは用いない)
+  if (depth < PARALLEL_MIN_DEPTH) {
+    Position p = pos;
+    p.set_repetition_table(nullptr);
+    return perft<Filter>(p, depth);
+  }
+
+  ExtMove moves[MAX_MOVES];
+  ExtMove *last = Filter ? generate_legal_by_filter(pos, moves)
+                         : generateMoves<LEGAL_ALL>(pos, moves);
+
+  return Threading::Pool.parallel_reduce(
+      0, size_t(last - moves), u64(0),
+      [&](size_t i) {
+        Position p = pos;
+        p.set_repetition_table(nullptr);
+        StateInfo si;
+        p.do_move(moves[i].move, si);
+        return parallel_perft<Filter>(p, depth - 1);
+      },
+      [](u64 a, u64 b) { return a + b; });
+}
+
+// 指し手生成の速度計測
+void bench_movegen() {
+  auto sfens = random_sfens(1000, 64);
+
+  vector<StateInfo> si(sfens.size());
+  vector<Position> positions(sfens.size());
+  for (size_t i = 0; i < sfens.size(); ++i)
+    positions[i].set(sfens[i], &si[i]);
+
+  // 直接生成した合法手と、従来の方法で生成した合法手が集合として一致するか確認しておく。
+  size_t moves = 0, mismatches = 0;
+  for (auto &pos : positions) {
+    MoveList<LEGAL_ALL> ml(pos);
+    ExtMove ref[MAX_MOVES];
+    ExtMove *ref_last = generate_legal_by_filter(pos, ref);
+    vector<Move> a(ml.begin(), ml.end()), b(ref, ref_last);
+    sort(a.begin(), a.end());
+    sort(b.begin(), b.end());
+    mismatches += a != b;
+    moves += a.size();
+  }
+
+  // 1局面あたりの生成時間[ns]。生成した指し手の数をgeneratedに足し込んで、生成が最適化で消えないようにする。
+  const int loop = 200;
+  auto measure = [&](auto gen, u64 &generated) {
+    generated = 0;
+    TimePoint start = now();
+    for (int i = 0; i < loop; ++i)
+      for (auto &pos : positions) {
+        ExtMove mlist[MAX_MOVES];
+        generated += u64(gen(pos, mlist) - mlist);
+      }
+    TimePoint elapsed = std::max(now() - start, TimePoint(1));
+    generated /= loop;
+    return double(elapsed) * 1000000 / (double(loop) * positions.size());
+  };
+
+  u64 n_legal_all, n_legal, n_filter;
+  const double t_legal_all = measure(
+      [](const Position &pos, ExtMove *m) { return generateMoves<LEGAL_ALL>(pos, m); }, n_legal_all);
+  const double t_legal = measure(
+      [](const Position &pos, ExtMove *m) { return generateMoves<LEGAL>(pos, m); }, n_legal);
+  const double t_filter = measure(
+      [](const Position &pos, ExtMove *m) { return generate_legal_by_filter(pos, m); }, n_filter);
+
+  cout << "===== movegen bench =====" << endl
+       << "positions         : " << positions.size() << endl
+       << "legal moves       : " << moves << endl
+       << "mismatches        : " << mismatches << endl
+       << "LEGAL_ALL         : " << t_legal_all << " ns/pos, " << n_legal_all << " moves" << endl
+       << "LEGAL             : " << t_legal << " ns/pos, " << n_legal << " moves" << endl
+       << "legal() filtered  : " << t_filter << " ns/pos, " << n_filter << " moves" << endl;
+}
+
+// 評価関数の速度計測。同じ局面を繰り返し評価するので、EvalHashは用いずに評価関数そのものを計測する。
+void bench_eval() {
+  auto sfens = random_sfens(1000, 64);
+
+  // sfen文字列からの局面の設定は計測に含めたくないので、先に全部設定しておく。
+  vector<StateInfo> si(sfens.size());
+  vector<Position> positions(sfens.size());
+  for (size_t i = 0; i < sfens.size(); ++i)
+    positions[i].set(sfens[i], &si[i]);
+
+  const int loop = 20;
+  s64 sum = 0;
+  TimePoint start = now();
+  for (int i = 0; i < loop; ++i)
+    for (auto &pos : positions)
+      sum += Eval::compute_eval(pos);
+  TimePoint elapsed = std::max(now() - start, TimePoint(1));
+
+  const u64 evals = u64(loop) * positions.size();
+  cout << "===== eval bench =====" << endl
+       << "KKPEE size        : " << sizeof(Eval::KKPEETable) << " bytes" << endl
+       << "positions         : " << positions.size() << endl
+       << "evaluations       : " << evals << endl
+       << "time(ms)          : " << elapsed << endl
+       << "ns/eval           : " << double(elapsed) * 1000000 / evals << endl
+       << "checksum          : " << sum << endl;
+}
+
+// 千日手判定の計測。索引(RepetitionTable)による判定と、StateInfoを遡る従来の判定を比較する。
+// 千日手が起こりやすいように、ランダムプレイヤーは2手前に動かした駒を確率2/3で元の升に戻す。
+void bench_repetition() {
+  PRNG prng(20240601);
+  RepetitionTable table;
+  const int max_ply = 256;
+  vector<StateInfo> si(max_ply + 1);
+  vector<Move> moves;
+  u64 positions = 0, repetitions = 0, mismatches = 0;
+  Position pos;
+
+  auto play = [&]() {
+    pos.set_hirate(&si[0]);
+    pos.set_repetition_table(&table);
+    moves.clear();
+    for (int ply = 1; ply <= max_ply; ++ply) {
+      MoveList<LEGAL_ALL> ml(pos);
+      if (ml.size() == 0)
+        break;
+
+      Move m = ml.at(prng.rand(ml.size())).move;
+      if (moves.size() >= 2 && prng.rand(3) != 0) {
+        const Move back = moves[moves.size() - 2];
+        for (auto em : ml)
+          if (!is_drop(back) && !is_promote(back) && !is_promote(em.move) &&
+              move_from(em.move) == move_to(back) && move_to(em.move) == move_from(back))
+            m = em.move;
+      }
+      pos.do_move(m, si[ply]);
+      moves.push_back(m);
+    }
+  };
+
+  // 正しさの検証 : 遡る手数を制限しない従来の判定と結果が一致すること。
+  for (int g = 0; g < 1000; ++g) {
+    play();
+    for (int i = int(moves.size()) - 1; i >= 0; --i) {
+      const RepetitionState rs = pos.is_repetition();
+      repetitions += rs != REPETITION_NONE;
+      mismatches += rs != pos.is_repetition_by_scan(pos.state()->pliesFromNull);
+      ++positions;
+      pos.undo_move(moves[i]);
+    }
+  }
+
+  // 速度の計測 : 最後の1局の終局間際の局面で判定を繰り返す。(do_move/undo_moveの時間を含む)
+  play();
+  const int loop = 100000, window = 16;
+  u64 sum = 0;
+  auto measure = [&](auto judge) {
+    TimePoint start = now();
+    for (int i = 0; i < loop; ++i) {
+      for (int j = int(moves.size()) - 1; j >= int(moves.size()) - window; --j) {
+        sum += judge();
+        pos.undo_move(moves[j]);
+      }
+      for (int j = int(moves.size()) - window; j < int(moves.size()); ++j)
+        pos.do_move(moves[j], si[j + 1]);
+    }
+    TimePoint elapsed = std::max(now() - start, TimePoint(1));
+    return double(elapsed) * 1000000 / (double(loop) * window);
+  };
+  const double t_none = measure([]() { return 0; });
+  const double t_table = measure([&]() { return int(pos.is_repetition()); });
+  const double t_scan16 = measure([&]() { return int(pos.is_repetition_by_scan(16)); });
+  const double t_scan = measure([&]() { return int(pos.is_repetition_by_scan(pos.state()->pliesFromNull)); });
+
+  cout << "===== repetition bench =====" << endl
+       << "positions         : " << positions << endl
+       << "repetitions       : " << repetitions << endl
+       << "mismatches        : " << mismatches << endl
+       << "do/undo only      : " << t_none << " ns/pos" << endl
+       << "table             : " << t_table << " ns/pos" << endl
+       << "scan 16 plies     : " << t_scan16 << " ns/pos" << endl
+       << "scan whole game   : " << t_scan << " ns/pos" << endl
+       << "checksum          : " << sum << endl;
+}
+
+// 固定深さの探索の速度計測
+void bench_search(int depth) {
+  u64 nodes = 0;
+  TimePoint elapsed = 0;
+  Eval::reset_eval_hash_stats();
+
+  for (auto sfen : BenchSfens) {
+    Position pos;
+    StateListPtr states(new StateList(1));
+    pos.set(sfen, &states->back());
+
+    Search::clear();
+    Search::LimitsType limits;
+    limits.depth = depth;
+
+    Time.reset();
+    TimePoint start = now();
+    Search::start_thinking(pos, states, limits);
+    elapsed += now() - start;
+    nodes += Search::nodes_searched();
+  }
+
+  elapsed = std::max(elapsed, TimePoint(1));
+  cout << "===== search bench =====" << endl
+       << "depth             : " << depth << endl
+       << "nodes             : " << nodes << endl
+       << "time(ms)          : " << elapsed << endl
+       << "nps               : " << nodes * 1000 / elapsed << endl;
+
+#if defined(USE_SEARCH_STATS)
+  const auto stats = Eval::eval_hash_stats();
+  cout << "eval hash probes  : " << stats.probes << endl
+       << "eval hash hits    : " << stats.hits << " ("
+       << (stats.probes ? double(stats.hits) * 100 / stats.probes : 0.0) << "%)" << endl;
+#endif
+}
+
+} // namespace
+
+// bench [depth]
+//   depth : 探索速度の計測で用いる探索深さ(デフォルト7)
+void bench_cmd(Position &pos, istringstream &is) {
+  int depth = 7;
+  is >> depth;
+
+  // isreadyを経ずに呼び出されることがあるので、評価関数のテーブルを用意しておく。
+  Eval::load_eval();
+
+  bench_eval();
+  bench_movegen();
+  bench_repetition();
+  bench_search(depth);
+}
+
+// perft [depth]
+//   現局面からdepth手(デフォルト4)で到達する局面の数を、合法手を直接生成する方法と
+//   legal()で自殺手を取り除く従来の方法とで数えて、一致するか確認する。
+//   どちらもスレッドプールで並列に数える。(ワーカーの数はisreadyで設定される)
+void perft_cmd(Position &pos, istringstream &is) {
+  int depth = 4;
+  is >> depth;
+  depth = std::max(depth, 1);
+
+  TimePoint start = now();
+  const u64 nodes = parallel_perft<false>(pos, depth);
+  const TimePoint elapsed = std::max(now() - start, TimePoint(1));
+
+  start = now();
+  const u64 ref_nodes = parallel_perft<true>(pos, depth);
+  const TimePoint ref_elapsed = std::max(now() - start, TimePoint(1));
+
+  cout << "perft " << depth << " : " << nodes << " nodes, " << elapsed << " ms" << endl
+       << "legal() filtered : " << ref_nodes << " nodes, " << ref_elapsed << " ms" << endl
+       << "threads          : " << Threading::Pool.size() + 1 << endl
+       << (nodes == ref_nodes ? "OK" : "Error! perft mismatch") << endl;
+}
@@ -0,0 +1,596 @@
+﻿#include "../types.h"
+
+// USI拡張コマンド "tune"
+// 棋譜の局面と勝敗から、評価関数(KKPEE)のパラメーターをTexel法で調整する。
+// 調整結果はEvalFileで読み込める形式(Eval::write_params())で書き出す。
+// 思考エンジンの実行には関係しない。
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "../evaluate.h"
+#include "../misc.h"
+#include "../position.h"
+#include "../thread_pool.h"
+
+using namespace std;
+
+namespace {
+
+// ----------------------------------
+//      学習局面
+// ----------------------------------
+
+// KKPEEの評価値は、パラメーターについて高々2次の式になる。(利きの価値 × 利きの数の倍率、駒の価値 × 減ずる割合)
+// そこで1局面を、その式の係数だけに縮約して持つ。評価関数を呼び出さずに評価値と勾配が求まるので、
+// 1局面48バイト・数十nsで済み、数千万局面を1つのepochで扱える。
+struct TuneEntry {
+  // 盤上の駒の枚数(先手 - 後手) [ParamPieces]
+  int8_t piece[Eval::PARAM_PIECE_NB];
+
+  // 手駒の枚数(先手 - 後手) [ParamHandPieces]
+  int8_t hand[Eval::PARAM_HAND_NB];
+
+  // our_effect_value[d] × multi_effect_value[m]、their_effect_value[d] × multi_effect_value[m]の係数
+  // [玉からの距離][利きの数 - 1]。利きの数が0のときは倍率が0なので持たない。
+  int8_t our[5][2];
+  int8_t their[5][2];
+
+  // 先手から見た勝敗。0 : 負け, 1 : 引き分け, 2 : 勝ち
+  int8_t result;
+};
+
+// 局面posの評価値の係数をeに設定する。resultは先手から見た勝敗(0～2)
+void make_entry(const Position &pos, int result, TuneEntry &e) {
+  std::memset(&e, 0, sizeof(e));
+  e.result = int8_t(result);
+
+  for (int i = 0; i < Eval::PARAM_PIECE_NB; ++i)
+    e.piece[i] = int8_t(pos.pieces(BLACK, Eval::ParamPieces[i]).pop_count() -
+                        pos.pieces(WHITE, Eval::ParamPieces[i]).pop_count());
+
+  for (int i = 0; i < Eval::PARAM_HAND_NB; ++i)
+    e.hand[i] = int8_t(hand_count(pos.hand_of(BLACK), Eval::ParamHandPieces[i]) -
+                       hand_count(pos.hand_of(WHITE), Eval::ParamHandPieces[i]));
+
+  // Eval::apply_params()のKKPEEの計算と対応させること。
+  Bitboard one[COLOR_NB], two[COLOR_NB];
+  Eval::effect_count_bb(pos, BLACK, one[BLACK], two[BLACK]);
+  Eval::effect_count_bb(pos, WHITE, one[WHITE], two[WHITE]);
+
+  const Square kb = pos.king_square(BLACK);
+  const Square kw = pos.king_square(WHITE);
+  for (auto sq : SQ) {
+    const int m1 = ((one[BLACK].p >> sq) & 1) + ((two[BLACK].p >> sq) & 1);
+    const int m2 = ((one[WHITE].p >> sq) & 1) + ((two[WHITE].p >> sq) & 1);
+    const int db = dist(sq, kb);
+    const int dw = dist(sq, kw);
+    if (m1) {
+      e.our[db][m1 - 1] += 1;
+      e.their[dw][m1 - 1] += 1;
+    }
+    if (m2) {
+      e.their[db][m2 - 1] -= 1;
+      e.our[dw][m2 - 1] -= 1;
+    }
+  }
+}
+
+// ----------------------------------
+//      棋譜の読み込み
+// ----------------------------------
+
+// 学習局面の集合
+struct TuneData {
+  vector<TuneEntry> entries;
+  u64 games = 0;
+
+  // 係数から求めた評価値と、評価関数の値の差(読み込み時に確認する)
+  u64 checked = 0;
+  double error_sum = 0;
+  int error_max = 0;
+
+  // 局面を追加する。王手がかかっている局面と、直前に駒を取られた局面は静かでないので除く。
+  void add(const Position &pos, int result);
+};
+
+// パラメーターの添字。EvalParamsはint32_tのメンバーだけからなるので、その並びをそのまま用いる。
+constexpr int PARAM_NB = sizeof(Eval::EvalParams) / sizeof(int32_t);
+constexpr int P_PIECE = offsetof(Eval::EvalParams, piece_value) / sizeof(int32_t);
+constexpr int P_HAND = offsetof(Eval::EvalParams, having_value) / sizeof(int32_t);
+constexpr int P_OUR = offsetof(Eval::EvalParams, our_effect_value) / sizeof(int32_t);
+constexpr int P_THEIR = offsetof(Eval::EvalParams, their_effect_value) / sizeof(int32_t);
+constexpr int P_MULTI = offsetof(Eval::EvalParams, multi_effect_value) / sizeof(int32_t);
+constexpr int P_DISCOUNT = offsetof(Eval::EvalParams, piece_discount) / sizeof(int32_t);
+
+// 評価値の係数から先手から見た評価値を求めるための重み
+struct EntryWeights {
+  double piece[Eval::PARAM_PIECE_NB];
+  double hand[Eval::PARAM_HAND_NB];
+  double our[5][2];
+  double their[5][2];
+
+  explicit EntryWeights(const double *theta) {
+    const double discount = 1.0 - theta[P_DISCOUNT] / 1024;
+    for (int i = 0; i < Eval::PARAM_PIECE_NB; ++i)
+      piece[i] = theta[P_PIECE + i] * discount;
+    for (int i = 0; i < Eval::PARAM_HAND_NB; ++i)
+      hand[i] = theta[P_HAND + i];
+    for (int d = 0; d < 5; ++d)
+      for (int m = 0; m < 2; ++m) {
+        our[d][m] = theta[P_MULTI + m + 1] * theta[P_OUR + d] / (1024 * 1024);
+        their[d][m] = theta[P_MULTI + m + 1] * theta[P_THEIR + d] / (1024 * 1024);
+      }
+  }
+
+  double eval(const TuneEntry &e) const {
+    double v = 0;
+    for (int i = 0; i < Eval::PARAM_PIECE_NB; ++i)
+      v += piece[i] * e.piece[i];
+    for (int i = 0; i < Eval::PARAM_HAND_NB; ++i)
+      v += hand[i] * e.hand[i];
+    for (int d = 0; d < 5; ++d)
+      for (int m = 0; m < 2; ++m)
+        v += our[d][m] * e.our[d][m] + their[d][m] * e.their[d][m];
+    return v;
+  }
+};
+
+// EvalParamsをdoubleの配列に変換する。
+void params_to_theta(const Eval::EvalParams &params, double *theta) {
+  const int32_t *p = (const int32_t *)&params;
+  for (int i = 0; i < PARAM_NB; ++i)
+    theta[i] = p[i];
+}
+
+Eval::EvalParams theta_to_params(const double *theta) {
+  Eval::EvalParams params;
+  int32_t *p = (int32_t *)&params;
+  for (int i = 0; i < PARAM_NB; ++i)
+    p[i] = int32_t(std::lround(theta[i]));
+  return params;
+}
+
+void TuneData::add(const Position &pos, int result) {
+  if (pos.in_check() || pos.state()->capturedPiece != NO_PIECE)
+    return;
+
+  entries.emplace_back();
+  make_entry(pos, result, entries.back());
+
+  // 最初のいくらかの局面で、係数から求めた評価値が評価関数の値と(丸め誤差を除いて)一致するか確認しておく。
+  if (checked < 100000) {
+    double theta[PARAM_NB];
+    params_to_theta(Eval::Params, theta);
+    const double v = EntryWeights(theta).eval(entries.back());
+    const Value ev = Eval::compute_eval(pos);
+    const int diff = int(std::lround(std::abs(v - (pos.side_to_move() == BLACK ? ev : -ev))));
+    ++checked;
+    error_sum += diff;
+    error_max = std::max(error_max, diff);
+  }
+}
+
+// UTF-8の文字列sの位置iから、候補のいずれかの文字列で始まっていればその番号を返してiを進める。なければ-1。
+int match_any(const string &s, size_t &i, const vector<string> &candidates) {
+  for (size_t k = 0; k < candidates.size(); ++k)
+    if (s.compare(i, candidates[k].size(), candidates[k]) == 0) {
+      i += candidates[k].size();
+      return int(k);
+    }
+  return -1;
+}
+
+// KIF形式の棋譜を読み込む。
+// 5五将棋の盤面を、9x9の盤面の1～5筋・三～七段に置いた形式(client/data/record/*.kif)で、平手の初期局面から始まるもの。
+// 投了・詰みで終わった棋譜は勝敗を、千日手は引き分けを結果とし、それ以外(中断など)は用いない。
+bool read_kif(const string &filename, TuneData &data) {
+  ifstream ifs(filename);
+  if (!ifs)
+    return false;
+
+  static const vector<string> Digits = {"１", "２", "３", "４", "５", "６", "７", "８", "９"};
+  static const vector<string> Kanji = {"一", "二", "三", "四", "五", "六", "七", "八", "九"};
+  static const vector<string> DropPieces = {"歩", "銀", "角", "飛", "金"};
+  static const Piece DropPieceTypes[] = {PAWN, SILVER, BISHOP, ROOK, GOLD};
+
+  vector<Move> moves;
+  int result = -1; // 先手から見た勝敗
+  Square last_to = SQ_NB;
+
+  // 指し手をすべて読み込んでから、局面を進めて学習局面にする。(勝敗が最後まで分からないため)
+  Position pos;
+  StateListPtr states(new StateList(1));
+  pos.set_hirate(&states->back());
+
+  string line;
+  while (getline(ifs, line)) {
+    // 指し手の行 : "手数 指し手 (消費時間)"
+    istringstream ls(line);
+    int ply;
+    string token;
+    if (!(ls >> ply) || !(ls >> token) || ply != int(moves.size()) + 1)
+      continue;
+
+    const Color us = pos.side_to_move();
+    if (token == "投了" || token == "詰み") {
+      result = us == BLACK ? 0 : 2;
+      break;
+    }
+    if (token == "千日手" || token == "持将棋") {
+      result = 1;
+      break;
+    }
+
+    // 移動先
+    size_t i = 0;
+    Square to;
+    if (token.compare(0, string("同").size(), "同") == 0) {
+      // "同　銀(24)"のように全角空白が入る。
+      i = string("同").size();
+      match_any(token, i, {"　"});
+      to = last_to;
+    } else {
+      const int f = match_any(token, i, Digits);
+      const int r = match_any(token, i, Kanji) - 2;
+      if (f < 0 || f >= 5 || r < 0 || r >= 5)
+        return false;
+      to = File(f) | Rank(r);
+    }
+    if (to == SQ_NB)
+      return false;
+
+    // 駒打ちか移動か。移動元は"(筋段)"で書かれている。
+    Move move = MOVE_NONE;
+    const size_t paren = token.find('(');
+    const bool drop = token.find("打") != string::npos;
+    const bool promote = paren != string::npos && paren >= string("成").size() &&
+                         token.compare(paren - string("成").size(), string("成").size(), "成") == 0 &&
+                         token.find("不成") == string::npos &&
+                         token.compare(i, string("成銀(").size(), "成銀(") != 0;
+
+    Square from = SQ_NB;
+    Piece drop_piece = NO_PIECE;
+    if (drop) {
+      size_t j = i;
+      const int k = match_any(token, j, DropPieces);
+      if (k < 0)
+        return false;
+      drop_piece = DropPieceTypes[k];
+    } else {
+      if (paren == string::npos || paren + 3 >= token.size())
+        return false;
+      const int f = token[paren + 1] - '1';
+      const int r = token[paren + 2] - '3';
+      if (f < 0 || f >= 5 || r < 0 || r >= 5)
+        return false;
+      from = File(f) | Rank(r);
+    }
+
+    for (const auto &m : MoveList<LEGAL_ALL>(pos)) {
+      if (move_to(m.move) != to || is_drop(m.move) != drop)
+        continue;
+      if (drop ? move_dropped_piece(m.move) == drop_piece
+               : (move_from(m.move) == from && is_promote(m.move) == promote)) {
+        move = m.move;
+        break;
+      }
+    }
+    if (move == MOVE_NONE)
+      return false;
+
+    moves.push_back(move);
+    states->emplace_back();
+    pos.do_move(move, states->back());
+    last_to = to;
+  }
+
+  if (result < 0)
+    return false;
+
+  // 初期局面から指し直して、各局面を学習局面にする。
+  states = StateListPtr(new StateList(1));
+  pos.set_hirate(&states->back());
+  for (Move m : moves) {
+    data.add(pos, result);
+    states->emplace_back();
+    pos.do_move(m, states->back());
+  }
+  ++data.games;
+  return true;
+}
+
+// 局面と勝敗を1行ずつ書いたテキストを読み込む。自己対局の結果などを変換して用いる。
+//   "<sfen> <先手から見た勝敗>"  勝敗は 1 : 先手勝ち, 0 : 引き分け, -1 : 後手勝ち
+// 例) "rbsgk/4p/5/P4/KGSBR b - 1 1"
+bool read_sfens(const string &filename, TuneData &data) {
+  ifstream ifs(filename);
+  if (!ifs)
+    return false;
+
+  Position pos;
+  StateInfo si;
+  string line;
+  while (getline(ifs, line)) {
+    istringstream ls(line);
+    string board, side, hand, ply;
+    int result;
+    if (!(ls >> board >> side >> hand >> ply >> result) || result < -1 || result > 1)
+      continue;
+
+    pos.set(board + " " + side + " " + hand + " " + ply, &si);
+    data.add(pos, result + 1);
+  }
+  return true;
+}
+
+// filenameがディレクトリならその中の.kifと.txtを、ファイルなら拡張子に応じて読み込む。
+void read_input(const string &filename, TuneData &data) {
+  namespace fs = std::filesystem;
+
+  std::error_code ec;
+  vector<string> files;
+  if (fs::is_directory(filename, ec)) {
+    for (const auto &entry : fs::directory_iterator(filename, ec))
+      files.push_back(entry.path().string());
+    std::sort(files.begin(), files.end());
+  } else
+    files.push_back(filename);
+
+  u64 failed = 0;
+  for (const auto &file : files) {
+    const string ext = fs::path(file).extension().string();
+    if (ext == ".kif") {
+      if (!read_kif(file, data))
+        ++failed;
+    } else if (ext == ".txt" || files.size() == 1) {
+      if (!read_sfens(file, data))
+        ++failed;
+    }
+  }
+
+  cout << "info string read " << filename << " : games " << data.games << ", positions "
+       << data.entries.size() << (failed ? ", skipped files " + to_string(failed) : "") << endl;
+}
+
+// ----------------------------------
+//      パラメーターの調整
+// ----------------------------------
+
+// 調整しないパラメーター(玉の価値は先後で打ち消しあう。利きの数の倍率は0と1.0を基準とする)
+bool is_fixed(int i) { return i == P_PIECE + 5 || i == P_MULTI + 0 || i == P_MULTI + 1; }
+
+// パラメーターの値の範囲(Eval::read_params()で受け付けられる範囲)
+// この範囲に収めておけば、書き出したパラメーターでKKPEEを計算してもint16_tに収まる。
+double param_max(int i) {
+  return i < P_OUR        ? Eval::MAX_PIECE_VALUE
+         : i < P_MULTI    ? Eval::MAX_EFFECT_VALUE
+         : i < P_DISCOUNT ? Eval::MAX_MULTI_EFFECT_VALUE
+                          : Eval::MAX_PIECE_DISCOUNT;
+}
+
+// 損失と勾配を並列に求める。
+class Tuner {
+public:
+  Tuner(const vector<TuneEntry> &entries, size_t threads) : entries(entries), threads(threads) {}
+
+  // 評価値を勝率に変換する係数。σ(v) = 1 / (1 + exp(-v / K))
+  double K = 600;
+
+  // パラメーターthetaでの平均二乗誤差を返す。gradがnullptrでなければ勾配も求める。
+  double loss(const double *theta, double *grad) const;
+
+private:
+  // 1スレッド分の集計
+  struct Partial {
+    double loss = 0;
+    double piece[Eval::PARAM_PIECE_NB] = {};
+    double hand[Eval::PARAM_HAND_NB] = {};
+    double our[5][2] = {};
+    double their[5][2] = {};
+  };
+
+  const vector<TuneEntry> &entries;
+  size_t threads;
+};
+
+double Tuner::loss(const double *theta, double *grad) const {
+  const EntryWeights w(theta);
+  vector<Partial> partials(threads);
+
+  // 局面をスレッド数で等分して、スレッドプールで並列に集計する。
+  // (分割を固定しておくことで、スレッドの割り当てによらず同じ値になる)
+  auto worker = [&](size_t id) {
+    Partial &p = partials[id];
+    const size_t begin = entries.size() * id / threads;
+    const size_t end = entries.size() * (id + 1) / threads;
+    for (size_t n = begin; n < end; ++n) {
+      const TuneEntry &e = entries[n];
+      const double s = 1.0 / (1.0 + std::exp(-w.eval(e) / K));
+      const double diff = s - e.result * 0.5;
+      p.loss += diff * diff;
+      if (grad == nullptr)
+        continue;
+
+      // 評価値についての微分
+      const double g = 2 * diff * s * (1 - s) / K;
+      for (int i = 0; i < Eval::PARAM_PIECE_NB; ++i)
+        p.piece[i] += g * e.piece[i];
+      for (int i = 0; i < Eval::PARAM_HAND_NB; ++i)
+        p.hand[i] += g * e.hand[i];
+      for (int d = 0; d < 5; ++d)
+        for (int m = 0; m < 2; ++m) {
+          p.our[d][m] += g * e.our[d][m];
+          p.their[d][m] += g * e.their[d][m];
+        }
+    }
+  };
+
+  Threading::Pool.parallel_for(0, threads, worker);
+
+  Partial sum;
+  for (const auto &p : partials) {
+    sum.loss += p.loss;
+    for (int i = 0; i < Eval::PARAM_PIECE_NB; ++i)
+      sum.piece[i] += p.piece[i];
+    for (int i = 0; i < Eval::PARAM_HAND_NB; ++i)
+      sum.hand[i] += p.hand[i];
+    for (int d = 0; d < 5; ++d)
+      for (int m = 0; m < 2; ++m) {
+        sum.our[d][m] += p.our[d][m];
+        sum.their[d][m] += p.their[d][m];
+      }
+  }
+
+  const double n = double(std::max<size_t>(entries.size(), 1));
+  if (grad != nullptr) {
+    // 評価値の係数についての勾配から、パラメーターについての勾配を求める。(EntryWeightsの式の微分)
+    std::fill(grad, grad + PARAM_NB, 0.0);
+    double material = 0;
+    for (int i = 0; i < Eval::PARAM_PIECE_NB; ++i) {
+      grad[P_PIECE + i] = sum.piece[i] * (1.0 - theta[P_DISCOUNT] / 1024) / n;
+      material += sum.piece[i] * theta[P_PIECE + i];
+    }
+    grad[P_DISCOUNT] = -material / 1024 / n;
+    for (int i = 0; i < Eval::PARAM_HAND_NB; ++i)
+      grad[P_HAND + i] = sum.hand[i] / n;
+    for (int d = 0; d < 5; ++d)
+      for (int m = 0; m < 2; ++m) {
+        const double multi = theta[P_MULTI + m + 1];
+        grad[P_OUR + d] += multi * sum.our[d][m] / (1024 * 1024) / n;
+        grad[P_THEIR + d] += multi * sum.their[d][m] / (1024 * 1024) / n;
+        grad[P_MULTI + m + 1] += (theta[P_OUR + d] * sum.our[d][m] + theta[P_THEIR + d] * sum.their[d][m]) /
+                                 (1024 * 1024) / n;
+      }
+  }
+  return sum.loss / n;
+}
+
+} // namespace
+
+// tune [threads N] [epochs N] [lr X] [output FILE] INPUT...
+//   threads : 損失の計算に用いるスレッド数(デフォルトは論理コア数)
+//   epochs  : 全局面を用いた勾配の計算とパラメーターの更新(Adam)の回数(デフォルト200)
+//   lr      : 学習率。1回の更新で、各パラメーターを初期値の大きさのこの割合ほど動かす。(デフォルト0.01)
+//   output  : 調整したパラメーターの書き出し先(デフォルト"eval_params.bin")。EvalFileで読み込める。
+//   INPUT   : 棋譜のファイルかディレクトリ。.kifはKIF形式、それ以外は"<sfen> <勝敗>"のテキスト。
+// パラメーターの初期値は現在のもの(EvalFileを読み込んでいればその値)を用いる。
+void tune_cmd(Position &pos, istringstream &is) {
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  int epochs = 200;
+  double lr = 0.01;
+  string output = "eval_params.bin";
+
+  // isreadyを経ずに呼び出されることがあるので、評価関数のパラメーターを用意しておく。
+  Eval::load_eval();
+
+  TuneData data;
+  string token;
+  while (is >> token) {
+    if (token == "threads")
+      is >> threads;
+    else if (token == "epochs")
+      is >> epochs;
+    else if (token == "lr")
+      is >> lr;
+    else if (token == "output")
+      is >> output;
+    else
+      read_input(token, data);
+  }
+  threads = std::max<size_t>(threads, 1);
+
+  // 呼び出したスレッドも集計に加わるので、ワーカーは1つ少なくてよい。
+  // プールは探索と共用なので、終わったらUSIオプションのThreadsで設定された数に戻す。
+  struct PoolSizeGuard {
+    const size_t saved = Threading::Pool.size();
+    ~PoolSizeGuard() { Threading::Pool.set_size(saved); }
+  } pool_size_guard;
+  Threading::Pool.set_size(threads - 1);
+
+  if (data.entries.empty()) {
+    cout << "info string Error! no positions to tune." << endl;
+    return;
+  }
+  cout << "info string positions " << data.entries.size() << " (" << data.games << " games, "
+       << data.entries.size() * sizeof(TuneEntry) / (1024 * 1024) << " MB), threads " << threads << endl
+       << "info string model error : mean " << data.error_sum / std::max<u64>(data.checked, 1)
+       << ", max " << data.error_max << " (" << data.checked << " positions)" << endl;
+
+  double theta[PARAM_NB];
+  params_to_theta(Eval::Params, theta);
+  Tuner tuner(data.entries, threads);
+
+  // 評価値を勝率に変換する係数Kを、初期パラメーターでの損失が最小になるように黄金分割探索で求める。
+  {
+    double lo = 10, hi = 5000;
+    const double phi = (std::sqrt(5.0) - 1) / 2;
+    for (int i = 0; i < 40; ++i) {
+      const double k1 = hi - (hi - lo) * phi, k2 = lo + (hi - lo) * phi;
+      tuner.K = k1;
+      const double l1 = tuner.loss(theta, nullptr);
+      tuner.K = k2;
+      const double l2 = tuner.loss(theta, nullptr);
+      (l1 < l2 ? hi : lo) = (l1 < l2 ? k2 : k1);
+    }
+    tuner.K = (lo + hi) / 2;
+  }
+
+  // Adam。パラメーターごとに大きさが大きく異なるので、ステップ幅は初期値の大きさに比例させる。
+  const double beta1 = 0.9, beta2 = 0.999, eps = 1e-12;
+  double step[PARAM_NB], m1[PARAM_NB] = {}, m2[PARAM_NB] = {}, grad[PARAM_NB];
+  for (int i = 0; i < PARAM_NB; ++i)
+    step[i] = lr * std::max(std::abs(theta[i]), 64.0);
+
+  TimePoint start = now();
+  const double initial_loss = tuner.loss(theta, nullptr);
+  cout << "info string K " << tuner.K << ", initial loss " << initial_loss << endl;
+
+  for (int epoch = 1; epoch <= epochs; ++epoch) {
+    const double l = tuner.loss(theta, grad);
+    for (int i = 0; i < PARAM_NB; ++i) {
+      if (is_fixed(i))
+        continue;
+      m1[i] = beta1 * m1[i] + (1 - beta1) * grad[i];
+      m2[i] = beta2 * m2[i] + (1 - beta2) * grad[i] * grad[i];
+      const double mh = m1[i] / (1 - std::pow(beta1, epoch));
+      const double vh = m2[i] / (1 - std::pow(beta2, epoch));
+      theta[i] = std::clamp(theta[i] - step[i] * mh / (std::sqrt(vh) + eps), 0.0, param_max(i));
+    }
+
+    if (epoch % 10 == 0 || epoch == epochs) {
+      const TimePoint elapsed = std::max(now() - start, TimePoint(1));
+      cout << "info string epoch " << epoch << " loss " << l << " positions/s "
+           << u64(double(data.entries.size()) * epoch * 1000 / elapsed) << endl;
+    }
+  }
+
+  const Eval::EvalParams params = theta_to_params(theta);
+  cout << "info string final loss " << tuner.loss(theta, nullptr) << endl;
+  cout << "info string piece";
+  for (auto v : params.piece_value)
+    cout << ' ' << v;
+  cout << " / hand";
+  for (auto v : params.having_value)
+    cout << ' ' << v;
+  cout << " / our";
+  for (auto v : params.our_effect_value)
+    cout << ' ' << v;
+  cout << " / their";
+  for (auto v : params.their_effect_value)
+    cout << ' ' << v;
+  cout << " / multi";
+  for (auto v : params.multi_effect_value)
+    cout << ' ' << v;
+  cout << " / discount " << params.piece_discount << endl;
+
+  if (Eval::write_params(output, params))
+    cout << "info string wrote " << output << endl;
+  else
+    cout << "info string Error! failed to write " << output << endl;
+}
@@ -0,0 +1,169 @@
+#include "kpp.h"
+
+#if defined(EVAL_KPP)
+
+#include "position.h"
+#include "usi.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+namespace Eval::KPP {
+
+namespace {
+
+// テーブルファイルの識別子とバージョン
+constexpr u32 FILE_MAGIC = 0x3550504b; // "KPP5"
+constexpr u32 FILE_VERSION = 1;
+
+// KKP[先手玉][後手玉][BonaPiece(先手視点)]
+int32_t KKP[SQ_NB][SQ_NB][FE_END];
+
+// KPP[玉(視点側から見た位置)][BonaPiece][BonaPiece]。KPP[k][a][b] == KPP[k][b][a]であること。
+int16_t KPP[SQ_NB][FE_END][FE_END];
+
+// 局面の玉以外の駒10枚のBonaPieceをlistに列挙する。
+void piece_list(const Position &pos, ExtBonaPiece *list) {
+  int n = 0;
+  for (auto sq : pos.pieces() & ~pos.pieces(KING))
+    list[n++] = bona_piece(pos.piece_on(sq), sq);
+
+  for (auto c : COLOR)
+    for (Piece pr : {PAWN, SILVER, BISHOP, ROOK, GOLD})
+      for (int i = 1; i <= hand_count(pos.hand_of(c), pr); ++i)
+        list[n++] = bona_piece_hand(c, pr, i);
+
+  ASSERT_LV3(n == PIECE_LIST_NB);
+}
+
+} // namespace
+
+bool enabled = false;
+
+// ----------------------------------
+//      評価値の計算
+// ----------------------------------
+
+void compute_eval(const Position &pos, StateInfo *si) {
+  ExtBonaPiece list[PIECE_LIST_NB];
+  piece_list(pos, list);
+
+  const Square kb = pos.king_square(BLACK);
+  const Square kw = pos.king_square(WHITE);
+  const auto &kkp = KKP[kb][kw];
+  const auto &kpp_b = KPP[kb];
+  const auto &kpp_w = KPP[Inv(kw)];
+
+  EvalSum &sum = si->evalSum;
+  sum.p[0] = sum.p[1] = sum.p[2] = 0;
+  for (int i = 0; i < PIECE_LIST_NB; ++i) {
+    sum.p[0] += kkp[list[i].fb];
+    for (int j = 0; j < i; ++j) {
+      sum.p[1] += kpp_b[list[i].fb][list[j].fb];
+      sum.p[2] += kpp_w[list[i].fw][list[j].fw];
+    }
+  }
+}
+
+void update_eval(const Position &pos, StateInfo *si) {
+  const DirtyPiece &dp = si->dirtyPiece;
+
+  // 玉が移動したらKKPもKPPも全部変わるので全計算。
+  if (dp.king_moved[BLACK] || dp.king_moved[WHITE]) {
+    compute_eval(pos, si);
+    return;
+  }
+
+  ExtBonaPiece list[PIECE_LIST_NB];
+  piece_list(pos, list);
+
+  const Square kb = pos.king_square(BLACK);
+  const Square kw = pos.king_square(WHITE);
+  const auto &kkp = KKP[kb][kw];
+  const auto &kpp_b = KPP[kb];
+  const auto &kpp_w = KPP[Inv(kw)];
+
+  EvalSum sum = si->previous->evalSum;
+  const int n = dp.dirty_num;
+  const ExtBonaPiece *old_piece = dp.old_piece;
+  const ExtBonaPiece *new_piece = dp.new_piece;
+
+  for (int i = 0; i < n; ++i)
+    sum.p[0] += kkp[new_piece[i].fb] - kkp[old_piece[i].fb];
+
+  // 変化しなかった駒との2駒関係を差し替える。
+  for (const auto &r : list) {
+    if (r.fb == new_piece[0].fb || (n == 2 && r.fb == new_piece[1].fb))
+      continue;
+
+    for (int i = 0; i < n; ++i) {
+      sum.p[1] += kpp_b[new_piece[i].fb][r.fb] - kpp_b[old_piece[i].fb][r.fb];
+      sum.p[2] += kpp_w[new_piece[i].fw][r.fw] - kpp_w[old_piece[i].fw][r.fw];
+    }
+  }
+
+  // 変化した駒同士の2駒関係
+  if (n == 2) {
+    sum.p[1] += kpp_b[new_piece[0].fb][new_piece[1].fb] - kpp_b[old_piece[0].fb][old_piece[1].fb];
+    sum.p[2] += kpp_w[new_piece[0].fw][new_piece[1].fw] - kpp_w[old_piece[0].fw][old_piece[1].fw];
+  }
+
+  si->evalSum = sum;
+}
+
+Value evaluate(const Position &pos) {
+  const Value v = Value(pos.state()->evalSum.sum() / FV_SCALE);
+  return pos.side_to_move() == BLACK ? v : -v;
+}
+
+// ----------------------------------
+//      テーブルの読み込み
+// ----------------------------------
+
+bool read_parameters(const string &filename) {
+  ifstream ifs(filename, ios::binary);
+  if (!ifs)
+    return false;
+
+  // ヘッダー : 識別子, バージョン, 升の数, BonaPieceの数
+  u32 header[4];
+  ifs.read((char *)header, sizeof(header));
+  const u32 expected[4] = {FILE_MAGIC, FILE_VERSION, SQ_NB, FE_END};
+  if (!ifs || std::memcmp(header, expected, sizeof(header)) != 0)
+    return false;
+
+  ifs.read((char *)KKP, sizeof(KKP));
+  ifs.read((char *)KPP, sizeof(KPP));
+  if (!ifs || ifs.peek() != char_traits<char>::eof())
+    return false;
+
+  // 差分計算はKPPが対称であることを前提にしているので確認しておく。
+  for (auto k : SQ)
+    for (int a = 0; a < FE_END; ++a)
+      for (int b = 0; b < a; ++b)
+        if (KPP[k][a][b] != KPP[k][b][a])
+          return false;
+
+  return true;
+}
+
+void load_eval() {
+  enabled = false;
+  if (!(bool)(int)Options["UseKPP"])
+    return;
+
+  const string filename = Options["KPPFile"];
+  if (read_parameters(filename)) {
+    enabled = true;
+    cout << "info string KPP file " << filename << " loaded." << endl;
+  } else
+    cout << "info string Error! failed to load KPP file " << filename
+         << ". Use the default evaluation instead." << endl;
+}
+
+} // namespace Eval::KPP
+
+#endif // defined(EVAL_KPP)
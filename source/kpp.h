@@ -0,0 +1,57 @@
+#ifndef _KPP_H_
+#define _KPP_H_
+
+#include "bona_piece.h"
+#include "types.h"
+
+#include <string>
+
+class Position;
+struct StateInfo;
+
+// KKP + KPP 評価関数
+//
+//   KKP[先手玉][後手玉][BonaPiece(先手視点)]
+//   KPP[玉(視点側から見た位置)][BonaPiece][BonaPiece]
+//
+// 玉以外の駒10枚(手駒を含む)について、両玉との3駒関係(KKP)と、各玉と2駒との3駒関係(KPP)を合算する。
+// 合算値はStateInfo::evalSumに持ち、do_move()で変化した駒(DirtyPiece)の項だけを差分更新する。
+// 玉が移動したときは全計算する。
+//
+// テーブルはisreadyのときに"KPPFile"で指定されたファイルから読み込む。("UseKPP"がtrueのときのみ)
+namespace Eval::KPP {
+
+// テーブルの値は評価値(centi-pawn)をFV_SCALE倍したもの。
+constexpr int FV_SCALE = 32;
+
+// StateInfoに持たせる、評価値の各項の合計
+struct EvalSum {
+  // [0] : KKP, [1] : 先手玉のKPP, [2] : 後手玉のKPP。いずれも先手から見た値。(後手玉のKPPは符号反転前)
+  int32_t p[3];
+
+  // 先手から見た合計値(FV_SCALE倍)
+  int32_t sum() const { return p[0] + p[1] - p[2]; }
+};
+
+// KPP評価関数を用いるか。load_eval()で設定される。
+extern bool enabled;
+
+// "UseKPP"がtrueなら"KPPFile"からテーブルを読み込む。isreadyのときに呼び出される。
+// 読み込めなかったときはenabledをfalseにして、従来の評価関数を用いる。
+void load_eval();
+
+// テーブルを読み込む。ファイルがない・形式が違うときはfalseを返す。
+bool read_parameters(const std::string &filename);
+
+// 局面posの評価値の各項を全計算してsi->evalSumに設定する。
+void compute_eval(const Position &pos, StateInfo *si);
+
+// do_move()の最後に呼び出して、1つ前の局面のevalSumとdirtyPieceから現局面のevalSumを求める。
+void update_eval(const Position &pos, StateInfo *si);
+
+// 手番側から見た評価値を返す。
+Value evaluate(const Position &pos);
+
+} // namespace Eval::KPP
+
+#endif // _KPP_H_
@@ -5,6 +5,7 @@
 
 int main(int argc, char *argv[]) {
   // --- 全体的な初期化
+  USI::init(Options);
   Bitboards::init();
   Position::init();
   Search::init();
@@ -9,197 +9,313 @@ namespace Mate {
 // グローバル統計
 Mate::MateSearcher::MateStats global_mate_stats;
 
-// MateSearcherクラスの実装
-Value MateSearcher::search_mate(Position &pos, std::vector<Move> &pv, int depth, int ply_from_root) {
-    // mukou
-    return -VALUE_INFINITE;
-    ++nodes;
-
-    if (should_stop()) {
-        pv.clear();
-        return VALUE_ZERO;
+// ----------------------------------
+//      1手詰め・3手詰め判定
+// ----------------------------------
+
+namespace {
+
+// 指し手に移動後の駒(上位16bit)を付与する。
+inline Move with_piece(Move m, Piece pc) { return Move(u32(m) + (u32(pc) << 16)); }
+
+// 手番側usが駒pc(移動後の駒、先後の区別あり)をtoに置いて王手をしたときに相手玉が詰んでいるかを利きだけで判定する。
+// 盤上の駒の移動ならfromは移動元の升、駒打ちならfrom == SQ_NB。
+// 王手駒以外による王手(開き王手)は考慮しないので、両王手になる場合はfalseを返すことがある。(詰みを見逃すだけで誤判定はしない)
+bool is_mate_after(const Position &pos, Color us, Square from, Square to, Piece pc) {
+    const Color them = ~us;
+    const Square ksq = pos.king_square(them);
+
+    const Bitboard fromBB = from == SQ_NB ? ZERO_BB : Bitboard(from);
+
+    // 指し手を指したあとのoccupied bitboardと相手の駒
+    const Bitboard occ = (pos.pieces() & ~fromBB) | to;
+    const Bitboard themBB = pos.pieces(them) & ~Bitboard(to);
+
+    // 1) 玉の退路があるか
+    // 玉を取り除いたoccupiedで、移動先に手番側の利きがなければ逃げられる。
+    Bitboard escape = kingEffect(ksq) & ~themBB;
+    const Bitboard occNoKing = occ ^ ksq;
+    while (escape) {
+        Square sq = escape.pop();
+        if (!(pos.attackers_to(us, sq, occNoKing) & ~fromBB) && !effects_from(pc, to, occNoKing).test(sq))
+            return false;
     }
 
-    // 深さ0なら詰み判定のみ
-    if (depth == 0) {
-        pv.clear();
-        return is_mated_position(pos) ? mated_in(ply_from_root) : VALUE_ZERO;
+    // 2) 王手駒を玉以外の駒で取れるか
+    // 取ったあとに玉に利きが残らなければ(pinされていなければ)取って王手が解除できる。
+    Bitboard capturers = pos.attackers_to(them, to, occ) & themBB & ~Bitboard(ksq);
+    while (capturers) {
+        Square sq = capturers.pop();
+        if (!(pos.attackers_to(us, ksq, occ ^ sq) & ~fromBB))
+            return false;
     }
 
-    // 早期詰み判定
-    if (is_obvious_mate(pos)) {
-        pv.clear();
-        return mate_in(ply_from_root + 1);
+    // 3) 遠方からの王手なら合駒ができるか
+    const Bitboard between = between_bb(to, ksq);
+    if (between) {
+        // 手駒があるなら合駒できるものとみなす。
+        if (pos.hand_of(them) != HAND_ZERO)
+            return false;
+
+        // 間の升に移動できる駒があるなら合駒できるものとみなす。(pinは考慮しない)
+        Bitboard bb = between;
+        while (bb) {
+            Square sq = bb.pop();
+            if (pos.attackers_to(them, sq, occ) & themBB & ~Bitboard(ksq))
+                return false;
+        }
     }
 
-    // 王手のみを生成
-    auto check_moves = MoveList<CHECKS>(pos);
-    if (check_moves.size() == 0) {
-        pv.clear();
-        return VALUE_ZERO; // 王手なしで詰みなし
+    return true;
+}
+
+// 3手詰め判定の結果を保存するハッシュテーブル。
+// 1エントリを64bitに詰め、lock-freeに読み書きする。
+//   bit 0..15  : 詰ます指し手(16bit形式)。不詰ならMOVE_NONE
+//   bit 16     : 判定済みフラグ
+//   bit 32..63 : 局面のhash keyの上位32bit
+std::atomic<u64> mate_hash[MATE_HASH_ENTRY_NB];
+
+inline std::atomic<u64> &mate_hash_entry(Key key) { return mate_hash[key & (MATE_HASH_ENTRY_NB - 1)]; }
+
+} // namespace
+
+Move mate_1ply(const Position &pos) {
+    // 王手がかかっているなら回避が先なので調べない。
+    if (pos.in_check())
+        return MOVE_NONE;
+
+    const Color us = pos.side_to_move();
+    const Square ksq = pos.king_square(~us);
+
+    // --- 駒打ちによる王手
+    // 打ち歩詰めは反則なので歩は調べない。
+    const Hand hand = pos.hand_of(us);
+    if (hand != HAND_ZERO) {
+        const Bitboard empties = pos.empties();
+        for (Piece pt : {ROOK, BISHOP, GOLD, SILVER}) {
+            if (!hand_exists(hand, pt))
+                continue;
+
+            Bitboard target = pos.check_squares(pt) & empties;
+            while (target) {
+                Square to = target.pop();
+                if (is_mate_after(pos, us, SQ_NB, to, make_piece(us, pt)))
+                    return with_piece(make_move_drop(pt, to), make_piece(us, pt));
+            }
+        }
     }
 
-    Value best_value = -VALUE_INFINITE;
-    std::vector<Move> best_pv;
-    StateInfo si;
+    // --- 駒の移動による王手
+    // 移動元の候補はCheckCandidateBBで絞り込む。飛車・龍はどこからでも王手になりうる。
+    const Bitboard occ = pos.pieces();
+    const Bitboard target = ~pos.pieces(us);
+    const Bitboard pinned = pos.blockers_for_king(us);
+    const Square ourKsq = pos.king_square(us);
+
+    Bitboard candidates = (pos.pieces(us, PAWN) & check_candidate_bb(us, PAWN, ksq)) |
+                          (pos.pieces(us, SILVER) & check_candidate_bb(us, SILVER, ksq)) |
+                          (pos.pieces(us, GOLDS) & check_candidate_bb(us, GOLD, ksq)) |
+                          (pos.pieces(us, BISHOP) & check_candidate_bb(us, BISHOP, ksq)) |
+                          (pos.pieces(us, HORSE) & check_candidate_bb(us, ROOK, ksq)) |
+                          pos.pieces(us, ROOK, DRAGON);
+
+    while (candidates) {
+        const Square from = candidates.pop();
+        const Piece pc = pos.piece_on(from);
+        const Piece pt = type_of(pc);
+
+        Bitboard toBB = effects_from(pc, from, occ) & target;
+        while (toBB) {
+            const Square to = toBB.pop();
+
+            // pinされている駒はpinの方向にしか動けない。
+            if ((pinned & from) && !aligned(from, to, ourKsq))
+                continue;
+
+            const bool promotable = (pt == PAWN || pt == SILVER || pt == BISHOP || pt == ROOK) &&
+                                    (canPromote(us, from) || canPromote(us, to));
+
+            // 成れるなら成る指し手を先に調べる。
+            if (promotable) {
+                const Piece pro = Piece(pt + PIECE_PROMOTE);
+                if ((pos.check_squares(pro) & to) && is_mate_after(pos, us, from, to, make_piece(us, pro)))
+                    return with_piece(make_move_promote(from, to), make_piece(us, pro));
+            }
 
-    // 王手を評価値順にソート（簡易的なオーダリング）
-    std::vector<std::pair<Move, Value>> ordered_moves;
-    for (const auto& move : check_moves) {
-        Value move_value = VALUE_ZERO;
-        // 簡単な評価：captureなら優先（簡易実装）
-        if (move.move != MOVE_NONE) {
-            move_value = Value(1);
+            // 歩の成れる升への不成は反則、角・飛の不成は成りに劣るので調べない。
+            if (promotable && pt != SILVER)
+                continue;
+
+            if ((pos.check_squares(pt) & to) && is_mate_after(pos, us, from, to, pc))
+                return with_piece(make_move(from, to), pc);
         }
-        ordered_moves.emplace_back(move.move, move_value);
     }
 
-    std::sort(ordered_moves.begin(), ordered_moves.end(),
-              [](const auto& a, const auto& b) { return a.second > b.second; });
+    return MOVE_NONE;
+}
 
-    for (const auto& [move, _] : ordered_moves) {
-        if (should_stop()) break;
+Move mate_3ply(Position &pos) {
+    if (pos.in_check())
+        return MOVE_NONE;
+
+    // ハッシュテーブルに判定済みの結果があればそれを返す。
+    const Key key = pos.key();
+    std::atomic<u64> &entry = mate_hash_entry(key);
+    const u64 data = entry.load(std::memory_order_relaxed);
+    if ((data >> 32) == (key >> 32) && (data & (1 << 16))) {
+        const Move m = pos.reconstruct_move(Move16(data & 0xffff));
+        if (m == MOVE_NONE)
+            return MOVE_NONE;
+        // hash衝突で別局面の指し手を返さないように合法性を確認しておく。
+        if (pos.pseudo_legal(m) && pos.legal(m) && pos.gives_check(m))
+            return m;
+    }
 
-        std::vector<Move> child_pv;
+    Move result = MOVE_NONE;
+    StateInfo si, si2;
 
-        pos.do_move(move, si);
+    for (const ExtMove &check : MoveList<CHECKS>(pos)) {
+        if (!pos.legal(check.move))
+            continue;
 
-        // 相手の逃げ手を考慮
-        if (!pos.in_check()) {
-            // 逃げ手があるかチェック
-            auto evasion_moves = MoveList<EVASIONS>(pos);
-            if (evasion_moves.size() == 0) {
-                // 逃げ手なし → 詰み
-                pos.undo_move(move);
-                pv.clear();
-                pv.emplace_back(move);
-                return mate_in(ply_from_root + 1);
-            }
-        }
+        pos.do_move(check.move, si);
 
-        Value value = -search_mate_recursive(pos, child_pv, depth - 1, ply_from_root + 1, -best_value);
-        pos.undo_move(move);
+        // 相手のすべての応手に対して1手詰めがあるか。
+        // 応手がない(1手詰め)場合は通常の探索で見つかるのでここでは扱わない。
+        bool mated = true;
+        bool hasEvasion = false;
+        for (const ExtMove &evasion : MoveList<EVASIONS_ALL>(pos)) {
+            if (!pos.legal(evasion.move))
+                continue;
+            hasEvasion = true;
 
-        if (value > best_value) {
-            best_value = value;
-            best_pv.clear();
-            best_pv.emplace_back(move);
-            best_pv.insert(best_pv.end(), child_pv.begin(), child_pv.end());
+            pos.do_move(evasion.move, si2);
+            const bool mate = mate_1ply(pos) != MOVE_NONE;
+            pos.undo_move(evasion.move);
+
+            if (!mate) {
+                mated = false;
+                break;
+            }
         }
 
-        // 詰みが見つかったら即座に返す
-        if (value > VALUE_ZERO) {
-            pv = best_pv;
-            return value;
+        pos.undo_move(check.move);
+
+        if (mated && hasEvasion) {
+            result = check.move;
+            break;
         }
     }
 
-    pv = best_pv;
-    return best_value;
+    entry.store((key & 0xffffffff00000000ULL) | (1 << 16) | to_move16(result), std::memory_order_relaxed);
+    return result;
+}
+
+void clear_mate_hash() {
+    for (auto &entry : mate_hash)
+        entry.store(0, std::memory_order_relaxed);
 }
 
-Value MateSearcher::search_mate_recursive(Position &pos, std::vector<Move> &pv,
-                                         int depth, int ply_from_root, Value alpha) {
+// MateSearcherクラスの実装
+Value MateSearcher::search_mate(Position &pos, std::vector<Move> &pv, int depth, int ply_from_root) {
+    // 攻め方(手番側)の局面。depth手以内の詰みがあれば詰みのスコアを、なければVALUE_ZEROを返す。
     ++nodes;
 
-    if (should_stop()) {
+    if (should_stop() || pos.in_check()) {
         pv.clear();
         return VALUE_ZERO;
     }
 
-    // 深さ制限
-    if (depth <= 0) {
-        pv.clear();
-        return VALUE_ZERO; // この深さでは詰みを判定しない
+    // 1手詰めならそれで終わり
+    const Move mate_move = mate_1ply(pos);
+    if (mate_move != MOVE_NONE) {
+        pv.assign(1, mate_move);
+        return mate_in(ply_from_root + 1);
     }
 
-    // 早期千日手チェック
-    if (pos.is_repetition(16)) {
+    // 1手詰め以外は3手以上かかる
+    if (depth < 3) {
         pv.clear();
         return VALUE_ZERO;
     }
 
-    // 王手されている場合
-    if (pos.in_check()) {
-        // 詰みチェック
-        auto evasion_moves = MoveList<EVASIONS>(pos);
-        if (evasion_moves.size() == 0) {
-            pv.clear();
-            return mated_in(ply_from_root);
-        }
+    StateInfo si;
+    std::vector<Move> child_pv;
+    size_t index = 0;
 
-        // 逃げ手の中に詰み回避があるかチェック
-        StateInfo si;
-        for (const auto& move : evasion_moves) {
-            if (should_stop()) break;
+    for (const auto &check : MoveList<CHECKS>(pos)) {
+        if (should_stop())
+            break;
 
-            std::vector<Move> child_pv;
-            pos.do_move(move.move, si);
+        if (!pos.legal(check.move))
+            continue;
 
-            // 相手の攻撃手を探索
-            auto check_moves = MoveList<CHECKS>(pos);
-            bool has_escape = true;
+        // rootでは王手を複数の詰み探索スレッドで分担する。
+        if (ply_from_root == 0 && (index++ % root_count) != root_id)
+            continue;
 
-            if (!check_moves.size() == 0) {
-                Value escape_value = -search_mate_recursive(pos, child_pv, depth - 1, ply_from_root + 1, -alpha);
-                if (escape_value <= VALUE_ZERO) {
-                    has_escape = false; // 逃げ成功
-                }
-            }
+        pos.do_move(check.move, si);
+        const Value value = search_mate_recursive(pos, child_pv, depth - 1, ply_from_root + 1);
+        pos.undo_move(check.move);
 
-            pos.undo_move(move.move);
-
-            if (has_escape) {
-                pv.clear();
-                return VALUE_ZERO; // 逃げ手あり
-            }
+        // 詰みが見つかったら即座に返す
+        if (value > VALUE_ZERO) {
+            pv.assign(1, check.move);
+            pv.insert(pv.end(), child_pv.begin(), child_pv.end());
+            return value;
         }
-
-        // 逃げ手なし
-        pv.clear();
-        return mated_in(ply_from_root);
     }
 
-    // 王手を生成して探索
-    auto check_moves = MoveList<CHECKS>(pos);
-    if (check_moves.size() == 0) {
+    pv.clear();
+    return VALUE_ZERO;
+}
+
+Value MateSearcher::search_mate_recursive(Position &pos, std::vector<Move> &pv, int depth, int ply_from_root) {
+    // 玉方(王手をされている側)の局面。すべての応手に対して詰みがあれば攻め方から見た詰みのスコアを、
+    // 逃れる手があればVALUE_ZEROを返す。
+    ++nodes;
+
+    // 連続王手の千日手は攻め方の負けなので詰みとはみなさない。
+    if (should_stop() || pos.is_repetition() != REPETITION_NONE) {
         pv.clear();
-        return VALUE_ZERO; // 王手なし
+        return VALUE_ZERO;
     }
 
-    Value best_value = -VALUE_INFINITE;
-    std::vector<Move> best_pv;
+    Value best_value = VALUE_MATE;
+    std::vector<Move> child_pv;
     StateInfo si;
+    bool has_evasion = false;
 
-    for (const auto& move : check_moves) {
-        if (should_stop()) break;
+    for (const auto &evasion : MoveList<EVASIONS_ALL>(pos)) {
+        if (!pos.legal(evasion.move))
+            continue;
+        has_evasion = true;
 
-        std::vector<Move> child_pv;
-        pos.do_move(move.move, si);
+        pos.do_move(evasion.move, si);
+        const Value value = search_mate(pos, child_pv, depth - 1, ply_from_root + 1);
+        pos.undo_move(evasion.move);
 
-        // 相手の応手を探索
-        Value value = -search_mate_recursive(pos, child_pv, depth - 1, ply_from_root + 1, -alpha);
-        pos.undo_move(move.move);
-
-        if (value > best_value) {
-            best_value = value;
-            best_pv.clear();
-            best_pv.emplace_back(move.move);
-            best_pv.insert(best_pv.end(), child_pv.begin(), child_pv.end());
+        // 1手でも逃れる手があれば不詰
+        if (value <= VALUE_ZERO) {
+            pv.clear();
+            return VALUE_ZERO;
         }
 
-        if (value > alpha) {
-            alpha = value;
+        // 玉方は最長の手順を選ぶ
+        if (value < best_value) {
+            best_value = value;
+            pv.assign(1, evasion.move);
+            pv.insert(pv.end(), child_pv.begin(), child_pv.end());
         }
+    }
 
-        // 詰みが見つかった
-        if (value > VALUE_ZERO) {
-            pv = best_pv;
-            return value;
-        }
+    // 応手がない == 詰み
+    if (!has_evasion) {
+        pv.clear();
+        return mate_in(ply_from_root);
     }
 
-    pv = best_pv;
     return best_value;
 }
 
@@ -216,16 +332,8 @@ MoveList<CHECKS> MateSearcher::generate_check_moves(const Position &pos) {
 }
 
 bool MateSearcher::is_obvious_mate(const Position &pos) {
-    // 簡単な詰み判定
-    // 例：王が1手で詰む場合など
-
-    if (!pos.in_check()) {
-        return false;
-    }
-
-    // 逃げ手のチェック
-    auto evasion_moves = MoveList<EVASIONS>(pos);
-    return evasion_moves.size() == 0;
+    // 手番側に1手詰めがあるか
+    return mate_1ply(pos) != MOVE_NONE;
 }
 
 bool MateSearcher::is_mated_position(const Position &pos) {
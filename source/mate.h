@@ -29,10 +29,19 @@ private:
     std::atomic<bool> stop_flag{false};
     std::atomic<uint64_t> nodes{0};
 
+    // rootの王手を複数の詰み探索スレッドで分担するときの、自分の担当番号とスレッド数
+    size_t root_id = 0;
+    size_t root_count = 1;
+
 public:
     // 単純な詰み探索
+    // 手番側がdepth手以内に詰ませられるなら詰みのスコア(mate_in)を、なければVALUE_ZEROを返す。
+    // 詰みのときはpvに詰み手順が入る。
     Value search_mate(Position &pos, std::vector<Move> &pv, int depth, int ply_from_root);
 
+    // rootの王手のうち、index % count == idのものだけを調べるようにする。
+    void set_root_partition(size_t id, size_t count) { root_id = id; root_count = count; }
+
     // N手詰みチェック
     bool is_mate_in_n(Position &pos, int n);
 
@@ -59,9 +68,9 @@ public:
     };
 
 private:
-    // 再帰的な詰み探索（内部使用）
+    // 再帰的な詰み探索（内部使用）。王手をされている玉方の局面で呼び出す。
     Value search_mate_recursive(Position &pos, std::vector<Move> &pv,
-                               int depth, int ply_from_root, Value alpha);
+                               int depth, int ply_from_root);
 
     // 局面の詰み判定
     bool is_mated_position(const Position &pos);
@@ -70,6 +79,23 @@ private:
     bool is_effective_check(const Position &pos, Move move);
 };
 
+// 1手詰め判定。
+// 手番側に1手で相手玉を詰ませる指し手があればその指し手を、なければMOVE_NONEを返す。
+// 指し手生成もdo_move()も行わず、check_squares()とCheckCandidateBBから王手になる指し手の候補を求め、
+// 利きのbitboardだけで玉の退路・王手駒の捕獲・合駒の有無を調べる。
+// 開き王手などは調べないので詰みを見逃すことはあるが、詰みでない局面で指し手を返すことはない。
+// 王手がかかっている局面ではMOVE_NONEを返す。
+Move mate_1ply(const Position &pos);
+
+// 3手詰め判定。
+// 手番側の王手に対して、相手のすべての応手で1手詰め(mate_1ply)が成立するなら、その初手を返す。
+// なければMOVE_NONEを返す。結果は専用の小さなハッシュテーブルに保存され、同一局面では再計算しない。
+// 王手がかかっている局面ではMOVE_NONEを返す。
+Move mate_3ply(Position &pos);
+
+// 3手詰め判定用のハッシュテーブルをクリアする。
+void clear_mate_hash();
+
 // 詰み探索のユーティリティ関数
 namespace Utils {
     // 持ち時間から詰み探索深さを決定
@@ -1,6 +1,18 @@
 ﻿#include <fstream>
 #include <sstream>
 
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "misc.h"
 
 using namespace std;
@@ -164,3 +176,76 @@ const std::string compiler_info() {
 TimePoint Timer::elapsed() const { return TimePoint(now() - startTime); }
 
 Timer Time;
+
+// --------------------
+//  ファイルのメモリマップ
+// --------------------
+
+bool MappedFile::open(const std::string &filename) {
+  close();
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  void *data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  if (data == nullptr) {
+    if (mapping)
+      CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+
+  file_ = file;
+  mapping_ = mapping;
+  data_ = data;
+  size_ = size_t(size.QuadPart);
+#else
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+
+  // マップした後はファイルディスクリプタは不要
+  void *data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED)
+    return false;
+
+  data_ = data;
+  size_ = size_t(st.st_size);
+#endif
+
+  return true;
+}
+
+void MappedFile::close() {
+  if (data_ == nullptr)
+    return;
+
+#ifdef _WIN32
+  UnmapViewOfFile(data_);
+  CloseHandle(mapping_);
+  CloseHandle(file_);
+  file_ = mapping_ = nullptr;
+#else
+  munmap(const_cast<void *>(data_), size_);
+#endif
+
+  data_ = nullptr;
+  size_ = 0;
+}
@@ -128,4 +128,36 @@ inline void aligned_free(void* ptr) {
 #endif
 }
 
+// --------------------
+//  ファイルのメモリマップ
+// --------------------
+
+// ファイルを読み込み専用でメモリにマップする。
+// 同じファイルを複数のプロセスでマップした場合、物理メモリはOSによって共有される。
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // filenameをマップする。ファイルがない・空のときはfalseを返す。
+  bool open(const std::string &filename);
+
+  // マップを解除する。
+  void close();
+
+  const void *data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  const void *data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  void *file_ = nullptr;
+  void *mapping_ = nullptr;
+#endif
+};
+
 #endif
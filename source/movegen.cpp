@@ -173,12 +173,14 @@ template <Piece Pt, Color Us, bool All> struct make_move_target {
 };
 
 // 指し手生成のうち、一般化されたもの。香・桂・銀はこの指し手生成を用いる。
+// movers : 移動させる駒の候補。合法手の生成では、pinされている駒を除くために用いる。
 template <MOVE_GEN_TYPE GenType, Piece Pt, Color Us, bool All>
 struct GeneratePieceMoves {
   FORCE_INLINE ExtMove *operator()(const Position &pos, ExtMove *mlist,
-                                   const Bitboard &target) {
+                                   const Bitboard &target,
+                                   const Bitboard &movers = ALL_BB) {
     // 盤上の駒pc(香・桂・銀)に対して
-    auto pieces = pos.pieces(Us, Pt);
+    auto pieces = pos.pieces(Us, Pt) & movers;
     const auto occ = pos.pieces();
 
     while (pieces) {
@@ -199,9 +201,10 @@ struct GeneratePieceMoves {
 template <MOVE_GEN_TYPE GenType, Color Us, bool All>
 struct GeneratePieceMoves<GenType, PAWN, Us, All> {
   FORCE_INLINE ExtMove *operator()(const Position &pos, ExtMove *mlist,
-                                   const Bitboard &target) {
+                                   const Bitboard &target,
+                                   const Bitboard &movers = ALL_BB) {
     // 盤上の自駒の歩に対して
-    auto pieces = pos.pieces(Us, PAWN);
+    auto pieces = pos.pieces(Us, PAWN) & movers;
 
     // 歩の利き
     auto target2 = pawnEffect(Us, pieces) & target;
@@ -226,9 +229,10 @@ struct GeneratePieceMoves<GenType, PAWN, Us, All> {
 template <MOVE_GEN_TYPE GenType, Color Us, bool All>
 struct GeneratePieceMoves<GenType, GPM_BR, Us, All> {
   FORCE_INLINE ExtMove *operator()(const Position &pos, ExtMove *mlist,
-                                   const Bitboard &target) {
+                                   const Bitboard &target,
+                                   const Bitboard &movers = ALL_BB) {
     // 角と飛に対して(馬と龍は除く)
-    auto pieces = pos.pieces(Us, BISHOP, ROOK);
+    auto pieces = pos.pieces(Us, BISHOP, ROOK) & movers;
     auto occ = pos.pieces();
 
     while (pieces) {
@@ -267,9 +271,10 @@ struct GeneratePieceMoves<GenType, GPM_GHDK, Us, All> {
 template <MOVE_GEN_TYPE GenType, Color Us, bool All>
 struct GeneratePieceMoves<GenType, GPM_GHD, Us, All> {
   FORCE_INLINE ExtMove *operator()(const Position &pos, ExtMove *mlist,
-                                   const Bitboard &target) {
+                                   const Bitboard &target,
+                                   const Bitboard &movers = ALL_BB) {
     // 金相当の駒・馬・龍に対して
-    auto pieces = pos.pieces(Us, GOLDS, HORSE, DRAGON);
+    auto pieces = pos.pieces(Us, GOLDS, HORSE, DRAGON) & movers;
     auto occ = pos.pieces();
     Square to;
 
@@ -388,8 +393,19 @@ template <Color Us> struct GenerateDropMoves {
   }
 };
 
+// c側の駒が利いている升。occは大駒の利きを求めるときの駒の配置。
+// 玉を移動させる指し手の合法性の判定に用いる。
+Bitboard effected_squares(const Position &pos, Color c, const Bitboard &occ) {
+  // 歩の利きはまとめてシフトで求める。
+  Bitboard bb = pawnEffect(c, pos.pieces(c, PAWN));
+  for (auto sq : pos.pieces(c) & ~pos.pieces(PAWN))
+    bb |= effects_from(pos.piece_on(sq), sq, occ);
+  return bb;
+}
+
 // 手番側が王手がかかっているときに、王手を回避する手を生成する。
-template <Color Us, bool All>
+// Legal : 自殺手を含まない合法手のみを生成する。falseなら自殺手が含まれることがある。(pseudo-legal)
+template <Color Us, bool All, bool Legal = false>
 ExtMove *generate_evasions(const Position &pos, ExtMove *mlist) {
   // この実装において引数のtargetは無視する。
 
@@ -432,6 +448,11 @@ ExtMove *generate_evasions(const Position &pos, ExtMove *mlist) {
   // 王手回避のための玉の移動先は、玉の利きで、自駒のない場所でかつさきほどの王手していた駒が利いていないところが候補として挙げられる
   // これがまだ自殺手である可能性もあるが、それはis_legal()でチェックすればいいと思う。
 
+  // Legalなら王手していない駒の利きも含めて、相手の利きのある升をすべて除外する。
+  // (自玉を取り除いたoccで求めるので、玉の背後に抜ける大駒の利きも含まれる)
+  if (Legal)
+    sliderAttacks |= effected_squares(pos, ~Us, occ);
+
   Bitboard bb = kingEffect(ksq) & ~(pos.pieces(Us) | sliderAttacks);
   while (bb) {
     Square to = bb.pop();
@@ -456,15 +477,20 @@ ExtMove *generate_evasions(const Position &pos, ExtMove *mlist) {
   const Bitboard target1 = between_bb(checksq, ksq);
   const Bitboard target2 = target1 | checksq;
 
+  // pinされている駒は王手を回避する升に移動できない。
+  // (pinの直線と王手の直線は玉でしか交わらず、王手している駒はpinの直線上にはないため)
+  const Bitboard movers =
+      Legal ? ~(pos.blockers_for_king(Us) & pos.pieces(Us)) : ALL_BB;
+
   // あとはNON_EVASIONS扱いで普通に指し手生成。
-  mlist =
-      GeneratePieceMoves<NON_EVASIONS, PAWN, Us, All>()(pos, mlist, target2);
-  mlist =
-      GeneratePieceMoves<NON_EVASIONS, SILVER, Us, All>()(pos, mlist, target2);
-  mlist =
-      GeneratePieceMoves<NON_EVASIONS, GPM_BR, Us, All>()(pos, mlist, target2);
+  mlist = GeneratePieceMoves<NON_EVASIONS, PAWN, Us, All>()(pos, mlist, target2,
+                                                           movers);
+  mlist = GeneratePieceMoves<NON_EVASIONS, SILVER, Us, All>()(pos, mlist,
+                                                             target2, movers);
+  mlist = GeneratePieceMoves<NON_EVASIONS, GPM_BR, Us, All>()(pos, mlist,
+                                                             target2, movers);
   mlist = GeneratePieceMoves<NON_EVASIONS, GPM_GHD, Us, All>()(
-      pos, mlist, target2); // 玉は除かないといけない
+      pos, mlist, target2, movers); // 玉は除かないといけない
   mlist = GenerateDropMoves<Us>()(pos, mlist, target1);
 
   return mlist;
@@ -848,6 +874,54 @@ ExtMove *generate_checks(const Position &pos, ExtMove *mlist) {
   return mlist;
 }
 
+// ----------------------------------
+//      合法手の生成
+// ----------------------------------
+
+// 王手がかかっていないときの合法手の生成。
+// 指し手を生成したあとでlegal()で自殺手を取り除くのではなく、自殺手をはじめから生成しない。
+//  ・pinされている駒は、玉とpinしている駒を結ぶ直線上にだけ移動させる。
+//  ・玉は相手の駒の利きのない升にだけ移動させる。
+//  ・駒打ちは自殺手にならない。(打ち歩詰めはGenerateDropMovesで除外されている)
+template <Color Us, bool All>
+ExtMove *generate_legal_non_evasions(const Position &pos, ExtMove *mlist) {
+  const Square ksq = pos.king_square(Us);
+  const Bitboard target = ~pos.pieces(Us);
+  const Bitboard pinned = pos.blockers_for_king(Us) & pos.pieces(Us);
+  const Bitboard movers = ~pinned;
+
+  // pinされていない駒(玉を除く)の移動
+  mlist = GeneratePieceMoves<NON_EVASIONS, PAWN, Us, All>()(pos, mlist, target,
+                                                           movers);
+  mlist = GeneratePieceMoves<NON_EVASIONS, SILVER, Us, All>()(pos, mlist,
+                                                             target, movers);
+  mlist = GeneratePieceMoves<NON_EVASIONS, GPM_BR, Us, All>()(pos, mlist,
+                                                             target, movers);
+  mlist = GeneratePieceMoves<NON_EVASIONS, GPM_GHD, Us, All>()(pos, mlist,
+                                                              target, movers);
+
+  // pinされている駒の移動。pinしている駒を取る指し手もこの直線上にある。
+  for (auto from : pinned)
+    mlist = make_move_target_general<Us, All>()(
+        pos, pos.piece_on(from), from, target & line_bb(ksq, from), mlist);
+
+  // 玉の移動。王手がかかっていないので、玉の背後に抜ける大駒の利きはなく、
+  // 玉を取り除かずに求めた利きで判定してよい。
+#if defined(USE_EFFECT_BOARD)
+  const Bitboard effected = pos.effected_bb(~Us);
+#else
+  const Bitboard effected = effected_squares(pos, ~Us, pos.pieces());
+#endif
+  Bitboard bb = kingEffect(ksq) & target & ~effected;
+  while (bb) {
+    Square to = bb.pop();
+    mlist++->move = make_move(ksq, to) + OurPt(Us, KING);
+  }
+
+  // 駒打ち
+  return GenerateDropMoves<Us>()(pos, mlist, pos.empties());
+}
+
 // ----------------------------------
 //      指し手生成踏み台
 // ----------------------------------
@@ -868,6 +942,18 @@ ExtMove *generateEvasionMoves(const Position &pos, ExtMove *mlist) {
              : generate_evasions<WHITE, All>(pos, mlist);
 }
 
+// 同じく、合法手の指し手生成を呼ぶための踏み台
+template <bool All>
+ExtMove *generateLegalMoves(const Position &pos, ExtMove *mlist) {
+  if (pos.in_check())
+    return pos.side_to_move() == BLACK
+               ? generate_evasions<BLACK, All, true>(pos, mlist)
+               : generate_evasions<WHITE, All, true>(pos, mlist);
+  return pos.side_to_move() == BLACK
+             ? generate_legal_non_evasions<BLACK, All>(pos, mlist)
+             : generate_legal_non_evasions<WHITE, All>(pos, mlist);
+}
+
 // 同じく、Checksの指し手生成を呼ぶための踏み台
 template <MOVE_GEN_TYPE GenType, bool All>
 ExtMove *generateChecksMoves(const Position &pos, ExtMove *mlist) {
@@ -888,22 +974,9 @@ ExtMove *generateMoves(const Position &pos, ExtMove *mlist, Square recapSq) {
                    (GenType == CAPTURES_PRO_PLUS_ALL) ||
                    (GenType == NON_CAPTURES_PRO_MINUS_ALL);
 
-  if (GenType == LEGAL || GenType == LEGAL_ALL) {
-
-    // 合法性な指し手のみを生成する。
-    // 自殺手や打ち歩詰めが含まれているのでそれを取り除く。かなり重い。ゆえにLEGALは特殊な状況でしか使うべきではない。
-    auto last = pos.in_check() ? generateEvasionMoves<All>(pos, mlist)
-                               : generateMoves<NON_EVASIONS, All>(pos, mlist);
-
-    // 合法ではない指し手を末尾の指し手と入れ替え
-    while (mlist != last) {
-      if (!pos.legal(*mlist))
-        mlist->move = (--last)->move;
-      else
-        ++mlist;
-    }
-    return last;
-  }
+  // 合法な指し手のみを生成する。pinと玉の移動先を考慮して生成するので、legal()で調べ直す必要はない。
+  if (GenType == LEGAL || GenType == LEGAL_ALL)
+    return generateLegalMoves<All>(pos, mlist);
 
   // 王手生成
   if (GenType == CHECKS || GenType == CHECKS_ALL || GenType == QUIET_CHECKS ||
@@ -0,0 +1,274 @@
+#include "nnue.h"
+
+#if defined(EVAL_NNUE)
+
+#include "position.h"
+#include "usi.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+namespace Eval::NNUE {
+
+// ----------------------------------
+//      パラメーター
+// ----------------------------------
+
+namespace {
+
+// 重みファイルの識別子とバージョン
+constexpr u32 FILE_MAGIC = 0x45554e4e; // "NNUE"
+constexpr u32 FILE_VERSION = 1;
+
+// 特徴変換層
+alignas(32) int16_t ft_biases[HALF_DIMENSIONS];
+alignas(32) int16_t ft_weights[INPUT_DIMENSIONS][HALF_DIMENSIONS];
+
+// 隠れ層1 : 2 * HALF_DIMENSIONS -> HIDDEN1
+alignas(32) int32_t l1_biases[HIDDEN1];
+alignas(32) int8_t l1_weights[HIDDEN1][2 * HALF_DIMENSIONS];
+
+// 隠れ層2 : HIDDEN1 -> HIDDEN2
+alignas(32) int32_t l2_biases[HIDDEN2];
+alignas(32) int8_t l2_weights[HIDDEN2][HIDDEN1];
+
+// 出力層 : HIDDEN2 -> 1
+int32_t out_bias;
+alignas(32) int8_t out_weights[HIDDEN2];
+
+} // namespace
+
+bool enabled = false;
+
+namespace {
+
+// 視点cから見た玉の位置
+Square king_square_from(const Position &pos, Color c) {
+  return c == BLACK ? pos.king_square(BLACK) : Inv(pos.king_square(WHITE));
+}
+
+// ----------------------------------
+//      特徴変換層
+// ----------------------------------
+
+// accにfeatureの重みを足す/引く。(ループはコンパイラの自動ベクトル化に任せる)
+inline void add_feature(int16_t *acc, int feature) {
+  const int16_t *w = ft_weights[feature];
+  for (int i = 0; i < HALF_DIMENSIONS; ++i)
+    acc[i] += w[i];
+}
+inline void sub_feature(int16_t *acc, int feature) {
+  const int16_t *w = ft_weights[feature];
+  for (int i = 0; i < HALF_DIMENSIONS; ++i)
+    acc[i] -= w[i];
+}
+
+// 視点cのアキュムレーターを局面から全計算する。
+void refresh_accumulator(const Position &pos, Color c, int16_t *acc) {
+  const int base = king_square_from(pos, c) * FE_END;
+
+  for (int i = 0; i < HALF_DIMENSIONS; ++i)
+    acc[i] = ft_biases[i];
+
+  // 盤上の駒(玉を除く)
+  for (auto sq : pos.pieces() & ~pos.pieces(KING))
+    add_feature(acc, base + bona_piece(pos.piece_on(sq), sq).from(c));
+
+  // 手駒
+  for (auto hc : COLOR)
+    for (Piece pr : {PAWN, SILVER, BISHOP, ROOK, GOLD})
+      for (int i = 1; i <= hand_count(pos.hand_of(hc), pr); ++i)
+        add_feature(acc, base + bona_piece_hand(hc, pr, i).from(c));
+}
+
+// 差分更新で遡る最大の手数。1手あたり最大で4回の加減算なので、これ以上遡ると全計算と変わらない。
+constexpr int MAX_UPDATE_PLY = 3;
+
+// 現局面のアキュムレーターを求める。
+// 数手前までにアキュムレーターが計算済みの局面があれば、そこからDirtyPieceを用いて差分更新する。
+// (探索の内部ノードでは評価関数を呼び出さないことがあるので、1手前だけでなく少し遡る)
+void update_accumulator(const Position &pos) {
+  StateInfo *st = pos.state();
+  Accumulator &accumulator = st->accumulator;
+  if (accumulator.computed)
+    return;
+
+  for (auto c : COLOR) {
+    int16_t *acc = accumulator.accumulation[c];
+
+    // 差分更新の起点となる計算済みの局面を探す。途中で視点側の玉が動いていたら全計算。
+    const StateInfo *path[MAX_UPDATE_PLY];
+    int n = 0;
+    const StateInfo *s = st;
+    while (n < MAX_UPDATE_PLY && s->previous != nullptr && !s->dirtyPiece.king_moved[c]) {
+      path[n++] = s;
+      s = s->previous;
+      if (s->accumulator.computed)
+        break;
+    }
+
+    if (!s->accumulator.computed) {
+      refresh_accumulator(pos, c, acc);
+      continue;
+    }
+
+    std::memcpy(acc, s->accumulator.accumulation[c], sizeof(int16_t) * HALF_DIMENSIONS);
+
+    // 古い局面から順に、変化した駒の分だけ更新していく。玉は動いていないのでbaseは共通。
+    const int base = king_square_from(pos, c) * FE_END;
+    while (n > 0) {
+      const DirtyPiece &dp = path[--n]->dirtyPiece;
+      for (int i = 0; i < dp.dirty_num; ++i) {
+        sub_feature(acc, base + dp.old_piece[i].from(c));
+        add_feature(acc, base + dp.new_piece[i].from(c));
+      }
+    }
+  }
+
+  accumulator.computed = true;
+}
+
+// ----------------------------------
+//      隠れ層
+// ----------------------------------
+
+// 入力(0～127)と重み(int8)のn次元の内積。nは32の倍数であること。
+inline int32_t dot_product(const uint8_t *input, const int8_t *weights, int n) {
+#if defined(USE_AVX2)
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i sum = _mm256_setzero_si256();
+  for (int i = 0; i < n; i += 32) {
+    // uint8 × int8 を隣り合う2つずつ足してint16に。入力が127以下なので飽和しない。
+    const __m256i product = _mm256_maddubs_epi16(
+        _mm256_loadu_si256((const __m256i *)(input + i)),
+        _mm256_loadu_si256((const __m256i *)(weights + i)));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(product, ones));
+  }
+  __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum128);
+
+#elif defined(USE_SSSE3)
+  const __m128i ones = _mm_set1_epi16(1);
+  __m128i sum = _mm_setzero_si128();
+  for (int i = 0; i < n; i += 16) {
+    const __m128i product = _mm_maddubs_epi16(
+        _mm_loadu_si128((const __m128i *)(input + i)),
+        _mm_loadu_si128((const __m128i *)(weights + i)));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(product, ones));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum);
+
+#elif defined(IS_ARM) && defined(__ARM_NEON)
+  int32x4_t sum = vdupq_n_s32(0);
+  for (int i = 0; i < n; i += 16) {
+    // 入力は127以下なのでint8として扱ってよい。
+    const int8x16_t a = vreinterpretq_s8_u8(vld1q_u8(input + i));
+    const int8x16_t b = vld1q_s8(weights + i);
+    int16x8_t product = vmull_s8(vget_low_s8(a), vget_low_s8(b));
+    product = vmlal_s8(product, vget_high_s8(a), vget_high_s8(b));
+    sum = vpadalq_s16(sum, product);
+  }
+  return vaddvq_s32(sum);
+
+#else
+  int32_t sum = 0;
+  for (int i = 0; i < n; ++i)
+    sum += int32_t(input[i]) * weights[i];
+  return sum;
+#endif
+}
+
+// 全結合層 + ClippedReLU。出力は0～127。
+template <int InDims, int OutDims>
+inline void affine_clipped_relu(const uint8_t *input, const int32_t *biases,
+                                const int8_t (*weights)[InDims], uint8_t *output) {
+  for (int i = 0; i < OutDims; ++i) {
+    const int32_t sum = biases[i] + dot_product(input, weights[i], InDims);
+    output[i] = uint8_t(std::clamp(sum >> WEIGHT_SCALE_BITS, 0, 127));
+  }
+}
+
+} // namespace
+
+// ----------------------------------
+//      評価関数
+// ----------------------------------
+
+Value evaluate(const Position &pos) {
+  update_accumulator(pos);
+
+  // 特徴変換層の出力を、手番側・相手側の順に連結して0～127にclipする。
+  alignas(32) uint8_t transformed[2 * HALF_DIMENSIONS];
+  const Accumulator &accumulator = pos.state()->accumulator;
+  const Color perspectives[2] = {pos.side_to_move(), ~pos.side_to_move()};
+  for (int p = 0; p < 2; ++p) {
+    const int16_t *acc = accumulator.accumulation[perspectives[p]];
+    for (int i = 0; i < HALF_DIMENSIONS; ++i)
+      transformed[p * HALF_DIMENSIONS + i] = uint8_t(std::clamp<int>(acc[i], 0, 127));
+  }
+
+  alignas(32) uint8_t hidden1[HIDDEN1];
+  alignas(32) uint8_t hidden2[HIDDEN2];
+  affine_clipped_relu<2 * HALF_DIMENSIONS, HIDDEN1>(transformed, l1_biases, l1_weights, hidden1);
+  affine_clipped_relu<HIDDEN1, HIDDEN2>(hidden1, l2_biases, l2_weights, hidden2);
+
+  const int32_t output = out_bias + dot_product(hidden2, out_weights, HIDDEN2);
+  return Value(output / FV_SCALE);
+}
+
+// ----------------------------------
+//      重みファイルの読み込み
+// ----------------------------------
+
+bool read_parameters(const string &filename) {
+  ifstream ifs(filename, ios::binary);
+  if (!ifs)
+    return false;
+
+  auto read = [&](void *p, size_t size) { ifs.read((char *)p, size); };
+
+  // ヘッダー : 識別子, バージョン, 各層の次元
+  u32 header[6];
+  read(header, sizeof(header));
+  const u32 expected[6] = {FILE_MAGIC, FILE_VERSION, INPUT_DIMENSIONS,
+                           HALF_DIMENSIONS, HIDDEN1, HIDDEN2};
+  if (!ifs || std::memcmp(header, expected, sizeof(header)) != 0)
+    return false;
+
+  read(ft_biases, sizeof(ft_biases));
+  read(ft_weights, sizeof(ft_weights));
+  read(l1_biases, sizeof(l1_biases));
+  read(l1_weights, sizeof(l1_weights));
+  read(l2_biases, sizeof(l2_biases));
+  read(l2_weights, sizeof(l2_weights));
+  read(&out_bias, sizeof(out_bias));
+  read(out_weights, sizeof(out_weights));
+
+  // 途中で途切れていないか、余分なデータがないか
+  return ifs && ifs.peek() == char_traits<char>::eof();
+}
+
+void load_eval() {
+  enabled = false;
+  if (!(bool)(int)Options["UseNNUE"])
+    return;
+
+  const string filename = Options["NNUEFile"];
+  if (read_parameters(filename)) {
+    enabled = true;
+    cout << "info string NNUE file " << filename << " loaded." << endl;
+  } else
+    cout << "info string Error! failed to load NNUE file " << filename
+         << ". Use the default evaluation instead." << endl;
+}
+
+} // namespace Eval::NNUE
+
+#endif // defined(EVAL_NNUE)
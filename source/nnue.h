@@ -0,0 +1,66 @@
+#ifndef _NNUE_H_
+#define _NNUE_H_
+
+#include "bona_piece.h"
+#include "types.h"
+
+#include <string>
+
+class Position;
+
+// NNUE(efficiently updatable neural network)評価関数
+//
+// ネットワーク構造
+//   入力層 : HalfKP(玉の位置 × 玉以外の駒の位置・手駒の枚数)。先手玉・後手玉それぞれの視点で求める。
+//   特徴変換層 : 入力 -> HALF_DIMENSIONS(int16)。この層の出力(アキュムレーター)はStateInfoに持ち、
+//               do_move()で変化した駒の分だけ差分更新する。
+//   隠れ層 : (手番側, 相手側)の2視点を連結したもの -> HIDDEN1 -> HIDDEN2 -> 1
+//           重みはint8、入力は0～127にclipしたuint8。
+//
+// 重みはisreadyのときに"NNUEFile"で指定されたファイルから読み込む。("UseNNUE"がtrueのときのみ)
+namespace Eval::NNUE {
+
+// --- ネットワークの次元
+
+// 1視点あたりの特徴変換層の出力の次元
+constexpr int HALF_DIMENSIONS = 64;
+
+// 隠れ層の次元
+constexpr int HIDDEN1 = 32;
+constexpr int HIDDEN2 = 32;
+
+// 評価値に変換するときに、出力層の値をこの値で割る。
+constexpr int FV_SCALE = 16;
+
+// 隠れ層の重みは、1.0を(1 << WEIGHT_SCALE_BITS)とする固定小数。
+constexpr int WEIGHT_SCALE_BITS = 6;
+
+// --- 特徴量
+
+// 入力層の次元 : 玉の位置(視点側から見たもの) × BonaPiece(bona_piece.h)
+constexpr int INPUT_DIMENSIONS = SQ_NB * FE_END;
+
+// 特徴変換層の出力。StateInfoに持たせる。
+struct alignas(32) Accumulator {
+  int16_t accumulation[COLOR_NB][HALF_DIMENSIONS];
+
+  // accumulationが計算済みか
+  bool computed;
+};
+
+// NNUE評価関数を用いるか。load_eval()で設定される。
+extern bool enabled;
+
+// "UseNNUE"がtrueなら"NNUEFile"から重みを読み込む。isreadyのときに呼び出される。
+// 読み込めなかったときはenabledをfalseにして、従来の評価関数を用いる。
+void load_eval();
+
+// 重みファイルを読み込む。ファイルがない・形式が違うときはfalseを返す。
+bool read_parameters(const std::string &filename);
+
+// 手番側から見た評価値を返す。必要ならアキュムレーターを差分更新する。
+Value evaluate(const Position &pos);
+
+} // namespace Eval::NNUE
+
+#endif // _NNUE_H_
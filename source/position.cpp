@@ -1,10 +1,12 @@
-﻿// #include "position.h"
-#include "search.h"
+﻿#include "position.h"
+#include "evaluate.h"
+#include "misc.h"
 
 #include <cstring>
 #include <iostream>
 #include <sstream>
 #include <stack>
+#include <vector>
 
 using namespace std;
 
@@ -17,6 +19,23 @@ Key psq[SQ_NB][PIECE_NB];
 Key hand[COLOR_NB][PIECE_HAND_NB];
 } // namespace Zobrist
 
+// has_game_cycle()で用いる、可逆な指し手のcuckoo hash table。
+// 盤上の駒をfromからtoに動かす指し手(駒を取らず、成らない)のうち、toからfromに戻る指し手もあるものを、
+// その指し手による局面のhash keyの変化量をkeyとして登録しておく。
+// hash keyは加算で更新しているので、fromからtoとtoからfromの指し手は別々に登録する。
+namespace Cuckoo {
+constexpr int SIZE = 8192;
+Key keys[SIZE];
+Move moves[SIZE];
+
+inline int H1(Key key) { return int(key & (SIZE - 1)); }
+inline int H2(Key key) { return int((key >> 16) & (SIZE - 1)); }
+
+// has_game_cycle()で遡る最大の手数。全nodeで呼び出すので、遠い局面までは調べない。
+// (遠くの局面に戻る千日手は、その手順を探索したときにis_repetition()で見つかる)
+constexpr int MAX_CYCLE_PLY = 16;
+} // namespace Cuckoo
+
 // ----------------------------------
 //           CheckInfo
 // ----------------------------------
@@ -78,6 +97,40 @@ void Position::init() {
     for (Piece pr : {PAWN, SILVER, BISHOP, ROOK, GOLD})
       SET_HASH(Zobrist::hand[c][pr], rng.rand<Key>() & ~1ULL, rng.rand<Key>(),
                rng.rand<Key>(), rng.rand<Key>());
+
+  // Cuckoo tableの初期化。
+  // 利きは盤上に駒がないときのものを用いる。(大駒の通り道が空いているかは、has_game_cycle()で調べる)
+  int count = 0;
+  for (auto c : COLOR)
+    for (Piece pt : {SILVER, BISHOP, ROOK, GOLD, KING, PRO_PAWN, PRO_SILVER, HORSE, DRAGON}) {
+      const Piece pc = make_piece(c, pt);
+      for (auto from : SQ)
+        for (auto to : effects_from(pc, from, ZERO_BB)) {
+          if (!(effects_from(pc, to, ZERO_BB) & from))
+            continue;
+
+          // 角・飛の成れる指し手は、指し手生成で成る指し手しか生成しないので、探索で選べない不成の指し手は登録しない。
+          // (登録すると、探索では指せない手順の千日手でalphaを引き上げてしまう)
+          if ((pt == BISHOP || pt == ROOK) && canPromote(c, from, to))
+            continue;
+
+          // 手番が変わるので、hash keyの最下位bitも変化する。
+          Move move = Move(make_move(from, to) + (u32(pc) << 16));
+          Key key = Zobrist::psq[to][pc] - Zobrist::psq[from][pc] + (c == BLACK ? 1 : -1);
+
+          // 空いている場所が見つかるまで、もう一方の場所に入っていたものを追い出していく。
+          int i = Cuckoo::H1(key);
+          while (true) {
+            std::swap(Cuckoo::keys[i], key);
+            std::swap(Cuckoo::moves[i], move);
+            if (move == MOVE_NONE)
+              break;
+            i = (i == Cuckoo::H1(key)) ? Cuckoo::H2(key) : Cuckoo::H1(key);
+          }
+          ++count;
+        }
+    }
+  ASSERT_LV1(count == 2264);
 }
 
 // sfen文字列で盤面を設定する
@@ -167,6 +220,9 @@ void Position::set(std::string sfen, StateInfo *si) {
 
   set_state(st);
 
+  // --- 千日手判定用の索引は外れている。(memsetでnullptrにしてある)
+  st->repetitionPly = RepetitionTable::NOT_INDEXED;
+
   // --- validation
 #if ASSERT_LV >= 3
   if (!is_ok(*this))
@@ -263,8 +319,86 @@ void Position::set_state(StateInfo *si) const {
 
   // --- hand
   si->hand = hand[sideToMove];
+
+#if defined(USE_EFFECT_BOARD)
+  // --- 利き
+  set_effect(si);
+#endif
+
+#if defined(EVAL_KPP)
+  // --- 評価値
+  if (Eval::KPP::enabled)
+    Eval::KPP::compute_eval(*this, si);
+#endif
 }
 
+#if defined(USE_EFFECT_BOARD)
+// bit-slicedな利きの数eに、bの升それぞれについて1を足す。
+static inline void inc_effect(Bitboard *e, Bitboard b) {
+  for (int i = 0; i < 4 && b; ++i) {
+    const Bitboard carry = e[i] & b;
+    e[i] ^= b;
+    b = carry;
+  }
+}
+
+// bit-slicedな利きの数eから、bの升それぞれについて1を引く。
+static inline void dec_effect(Bitboard *e, Bitboard b) {
+  for (int i = 0; i < 4 && b; ++i) {
+    const Bitboard borrow = ~e[i] & b;
+    e[i] ^= b;
+    b = borrow;
+  }
+}
+
+// pcがsqにあるとき(occupied bitboardはocc)の利きを、effect[color_of(pc)]に足す/引く。
+static inline void add_effect(StateInfo *si, Piece pc, Square sq,
+                              const Bitboard &occ) {
+  inc_effect(si->effect[color_of(pc)], effects_from(pc, sq, occ));
+}
+static inline void sub_effect(StateInfo *si, Piece pc, Square sq,
+                              const Bitboard &occ) {
+  dec_effect(si->effect[color_of(pc)], effects_from(pc, sq, occ));
+}
+
+void Position::set_effect(StateInfo *si) const {
+  for (auto c : COLOR)
+    for (auto &e : si->effect[c])
+      e = ZERO_BB;
+  const Bitboard occ = pieces();
+  for (auto sq : occ)
+    add_effect(si, piece_on(sq), sq, occ);
+}
+
+void Position::update_slider_effect(StateInfo *si, Square from, Square to,
+                                    const Bitboard &old_occ) const {
+  const Bitboard occ = pieces();
+
+  // 利きが変化しうるのは、移動前の盤面でfromかtoに長い利きが届いていた大駒だけ。
+  // (駒を取る指し手ではtoの占有状態は変わらないが、調べても害はない)
+  const Bitboard bishops = (bishopEffect(from, old_occ) | bishopEffect(to, old_occ)) &
+                           pieces(BISHOP_HORSE) & ~Bitboard(to);
+  const Bitboard rooks = (rookEffect(from, old_occ) | rookEffect(to, old_occ)) &
+                         pieces(ROOK_DRAGON) & ~Bitboard(to);
+
+  // 馬・龍の近接の利きは変化しないので、長い利きの部分だけ移動前後の差分を取る。
+  for (auto sq : bishops) {
+    const Bitboard before = bishopEffect(sq, old_occ);
+    const Bitboard after = bishopEffect(sq, occ);
+    Bitboard *e = si->effect[color_of(piece_on(sq))];
+    dec_effect(e, before & ~after); // 遮られた利き
+    inc_effect(e, after & ~before); // 開いた利き
+  }
+  for (auto sq : rooks) {
+    const Bitboard before = rookEffect(sq, old_occ);
+    const Bitboard after = rookEffect(sq, occ);
+    Bitboard *e = si->effect[color_of(piece_on(sq))];
+    dec_effect(e, before & ~after);
+    inc_effect(e, after & ~before);
+  }
+}
+#endif
+
 void Position::update_bitboards() {
   // 王・馬・龍を合成したbitboard
   byTypeBB[HDK] = pieces(KING, HORSE, DRAGON);
@@ -415,6 +549,154 @@ bool Position::gives_check(Move m) const {
                          !aligned(from, to, king_square(~sideToMove)));
 }
 
+// ----------------------------------
+//      SEE(静的交換評価)
+// ----------------------------------
+
+namespace {
+
+// 駒ptを取られたときに失う価値 = 盤上の駒の価値 + 相手の手駒になる価値
+inline int see_value(Piece pt) {
+  return Eval::PieceValue[pt] + Eval::HavingPieceValue[raw_type_of(pt)];
+}
+
+// 取り合いに用いる駒の順番。価値の低い駒から。
+constexpr Piece SeeOrder[] = {PAWN, PRO_PAWN, SILVER, PRO_SILVER, GOLD,
+                              BISHOP, ROOK, HORSE, DRAGON, KING};
+
+// 升toに利いているc側の駒attackersのうち、最も価値の低い駒を選んでその升を返す。
+// 選んだ駒をptに、その駒がtoに移動したあとの駒をafterに、成ることで増える価値をgainに返す。
+// attackersには1枚以上のc側の駒が含まれていること。
+inline Square least_valuable_attacker(const Position &pos, Color c, Square to,
+                                      const Bitboard &attackers, Piece &pt, Piece &after,
+                                      int &gain) {
+  for (Piece p : SeeOrder) {
+    const Bitboard bb = attackers & pos.pieces(p);
+    if (!bb)
+      continue;
+
+    const Square from = bb.pop_c();
+    pt = after = p;
+    gain = 0;
+    if ((p == PAWN || p == SILVER || p == BISHOP || p == ROOK) && canPromote(c, from, to)) {
+      const int g = Eval::PieceValue[p + PIECE_PROMOTE] - Eval::PieceValue[p];
+      // 歩は成れるなら必ず成る。(1段目への不成はできない)
+      if (p == PAWN || g > 0) {
+        after = Piece(p + PIECE_PROMOTE);
+        gain = g;
+      }
+    }
+    return from;
+  }
+  UNREACHABLE;
+  return SQ_NB;
+}
+
+} // namespace
+
+Value Position::see(Move m) const {
+  const Square to = move_to(m);
+  Bitboard occ = pieces();
+  if (!is_drop(m))
+    occ ^= move_from(m);
+
+  // gain[d] : d回目の駒取りで手番側(d回目に取る側)が得る価値。取り返されることは考えない。
+  int gain[32];
+  int d = 0;
+  Piece on_to = type_of(moved_piece_after(m));
+  gain[0] = is_drop(m) ? 0
+                       : see_value(type_of(piece_on(to))) + Eval::PieceValue[on_to] -
+                             Eval::PieceValue[type_of(piece_on(move_from(m)))];
+
+  Bitboard attackers = attackers_to(to, occ);
+  Color stm = sideToMove;
+  while (true) {
+    stm = ~stm;
+    attackers &= occ;
+    const Bitboard stmAttackers = attackers & pieces(stm);
+    if (!stmAttackers)
+      break;
+
+    Piece pt, after;
+    int g;
+    const Square from = least_valuable_attacker(*this, stm, to, stmAttackers, pt, after, g);
+
+    // 玉で取ると取り返されるなら、玉では取れない。
+    if (pt == KING && (attackers & pieces(~stm)))
+      break;
+
+    ++d;
+    gain[d] = see_value(on_to) + g - gain[d - 1];
+    on_to = after;
+
+    // 取った駒の背後にあった大駒の利きを追加する。
+    occ ^= from;
+    attackers |= (bishopEffect(to, occ) & pieces(BISHOP_HORSE)) |
+                 (rookEffect(to, occ) & pieces(ROOK_DRAGON));
+  }
+
+  // 取り返すと損になるなら取り返さない、として後ろから確定させていく。
+  while (d > 0) {
+    gain[d - 1] = -std::max(-gain[d - 1], gain[d]);
+    --d;
+  }
+  return Value(gain[0]);
+}
+
+bool Position::see_ge(Move m, Value threshold) const {
+  const Square to = move_to(m);
+  const Piece moved = type_of(moved_piece_after(m));
+
+  // surplus : 最後に駒を取った側が、取り返されなかったときに勝ちとなる境界を超える分。
+  // 手番側の勝ちはsee >= threshold、相手側の勝ちはsee < thresholdなので、
+  // 手番側はsee - threshold >= 0、相手側はthreshold - see >= 1で勝ちとなる。
+  int surplus = (is_drop(m) ? 0
+                            : see_value(type_of(piece_on(to))) + Eval::PieceValue[moved] -
+                                  Eval::PieceValue[type_of(piece_on(move_from(m)))]) -
+                threshold;
+
+  // 取り返されなくても閾値に届かない。
+  if (surplus < 0)
+    return false;
+
+  Bitboard occ = pieces();
+  if (!is_drop(m))
+    occ ^= move_from(m);
+  Bitboard attackers = attackers_to(to, occ);
+  Color stm = sideToMove;
+  Piece on_to = moved;
+
+  // res : 最後に駒を取った側が手番側なら1。これは次に取る側の勝ちの境界(相手側なら1、手番側なら0)でもある。
+  int res = 1;
+  while (true) {
+    stm = ~stm;
+    attackers &= occ;
+    const Bitboard stmAttackers = attackers & pieces(stm);
+    if (!stmAttackers)
+      break;
+
+    Piece pt, after;
+    int g;
+    const Square from = least_valuable_attacker(*this, stm, to, stmAttackers, pt, after, g);
+
+    // 玉で取ると取り返されるなら、玉では取れない。
+    if (pt == KING && (attackers & pieces(~stm)))
+      break;
+
+    // stmが取って(成って)も、取り返されなかったときに勝ちに届かないなら、stmは取らずに結果が確定する。
+    surplus = see_value(on_to) + g - surplus;
+    if (surplus < res)
+      break;
+
+    res ^= 1;
+    on_to = after;
+    occ ^= from;
+    attackers |= (bishopEffect(to, occ) & pieces(BISHOP_HORSE)) |
+                 (rookEffect(to, occ) & pieces(ROOK_DRAGON));
+  }
+  return bool(res);
+}
+
 // 現局面で指し手がないかをテストする。指し手生成ルーチンを用いるので速くない。探索中には使わないこと。
 bool Position::is_mated() const {
   // 不成で詰めろを回避できるパターンはないのでLEGAL_ALLである必要はない。
@@ -638,9 +920,6 @@ void Position::do_move_impl(Move m, StateInfo &new_st, bool givesCheck) {
 
   ASSERT_LV3(&new_st != st);
 
-  // 探索ノード数 ≒do_move()の呼び出し回数のインクリメント。
-  Search::Nodes += 1;
-
   // ----------------------
   //  StateInfoの更新
   // ----------------------
@@ -665,6 +944,26 @@ void Position::do_move_impl(Move m, StateInfo &new_st, bool givesCheck) {
   // st->previousで遡り可能な手数カウンタ
   st->pliesFromNull = prev->pliesFromNull + 1;
 
+  // 駒の移動だけで戻れる局面の範囲。駒取りのときは下で0にする。
+  st->pliesFromIrreversible = (is_drop(m) || is_promote(m)) ? 0 : prev->pliesFromIrreversible + 1;
+
+#if defined(USE_EFFECT_BOARD)
+  // 利きは前の局面のものをコピーしてから差分更新する。
+  for (auto c : COLOR)
+    for (int i = 0; i < 4; ++i)
+      st->effect[c][i] = prev->effect[c][i];
+#endif
+
+#if defined(EVAL_NNUE)
+  // アキュムレーターは評価関数を呼び出したときに、dirtyPieceを用いて差分計算する。
+  st->accumulator.computed = false;
+#endif
+#if defined(USE_DIRTY_PIECE)
+  auto &dp = st->dirtyPiece;
+  dp.dirty_num = 0;
+  dp.king_moved[BLACK] = dp.king_moved[WHITE] = false;
+#endif
+
   // 直前の指し手を保存する
   st->lastMove = m;
   st->lastMovedPieceType =
@@ -692,6 +991,17 @@ void Position::do_move_impl(Move m, StateInfo &new_st, bool givesCheck) {
     k += Zobrist::psq[to][pc];
     h -= Zobrist::hand[Us][pr];
 
+#if defined(USE_DIRTY_PIECE)
+    // 手駒の最後の1枚が盤上のtoに移動する。
+    dp.dirty_num = 1;
+    dp.old_piece[0] = Eval::bona_piece_hand(Us, pr, hand_count(hand[Us], pr));
+    dp.new_piece[0] = Eval::bona_piece(pc, to);
+#endif
+
+#if defined(USE_EFFECT_BOARD)
+    const Bitboard old_occ = pieces();
+#endif
+
     put_piece(to, pc);
 
     // 駒打ちなので手駒が減る。
@@ -712,6 +1022,12 @@ void Position::do_move_impl(Move m, StateInfo &new_st, bool givesCheck) {
 
     // put_piece()などを用いたのでupdateする
     update_bitboards();
+
+#if defined(USE_EFFECT_BOARD)
+    // 打った駒の利きを加え、toの升で遮られた大駒の利きを減らす。
+    add_effect(st, pc, to, pieces());
+    update_slider_effect(st, to, to, old_occ);
+#endif
   } else {
     // -- 駒の移動
     Square from = move_from(m);
@@ -727,6 +1043,15 @@ void Position::do_move_impl(Move m, StateInfo &new_st, bool givesCheck) {
 
     // 移動先の升にある駒
     Piece to_pc = piece_on(to);
+
+#if defined(USE_EFFECT_BOARD)
+    // 移動前の盤面で、移動させる駒と捕獲される駒の利きを取り除いておく。
+    const Bitboard old_occ = pieces();
+    sub_effect(st, moved_pc, from, old_occ);
+    if (to_pc != NO_PIECE)
+      sub_effect(st, to_pc, to, old_occ);
+#endif
+
     if (to_pc != NO_PIECE) {
       // --- capture(駒の捕獲)
 
@@ -748,6 +1073,14 @@ void Position::do_move_impl(Move m, StateInfo &new_st, bool givesCheck) {
 
       // 捕獲した駒をStateInfoに保存しておく。(undo_moveのため)
       st->capturedPiece = to_pc;
+      st->pliesFromIrreversible = 0;
+
+#if defined(USE_DIRTY_PIECE)
+      // 捕獲された駒は手駒の最後の1枚になる。
+      dp.old_piece[dp.dirty_num] = Eval::bona_piece(to_pc, to);
+      dp.new_piece[dp.dirty_num] = Eval::bona_piece_hand(Us, pr, hand_count(hand[Us], pr));
+      ++dp.dirty_num;
+#endif
     } else {
       // 駒を取らない指し手
       st->capturedPiece = NO_PIECE;
@@ -763,6 +1096,17 @@ void Position::do_move_impl(Move m, StateInfo &new_st, bool givesCheck) {
       kingSquare[Us] = to;
     }
 
+#if defined(USE_DIRTY_PIECE)
+    // 玉は特徴量に含まれないので、玉の移動はking_movedとして記録する。
+    if (type_of(moved_pc) == KING)
+      dp.king_moved[Us] = true;
+    else {
+      dp.old_piece[dp.dirty_num] = Eval::bona_piece(moved_pc, from);
+      dp.new_piece[dp.dirty_num] = Eval::bona_piece(moved_after_pc, to);
+      ++dp.dirty_num;
+    }
+#endif
+
     // fromにあったmoved_pcがtoにmoved_after_pcとして移動した。
     k -= Zobrist::psq[from][moved_pc];
     k += Zobrist::psq[to][moved_after_pc];
@@ -770,6 +1114,12 @@ void Position::do_move_impl(Move m, StateInfo &new_st, bool givesCheck) {
     // put_piece()などを用いたのでupdateする。
     update_bitboards();
 
+#if defined(USE_EFFECT_BOARD)
+    // 移動後の駒の利きを加え、fromが空いたこと・toが埋まったことによる大駒の利きの変化を反映させる。
+    add_effect(st, moved_after_pc, to, pieces());
+    update_slider_effect(st, from, to, old_occ);
+#endif
+
     // 王手している駒のbitboardを更新する。
     if (givesCheck) {
       st->checkersBB = attackers_to(Us, king_square(~Us));
@@ -793,8 +1143,18 @@ void Position::do_move_impl(Move m, StateInfo &new_st, bool givesCheck) {
 
   st->hand = hand[sideToMove];
 
+  // 千日手判定用の索引に登録する。
+  st->repetitionPly = repetitions ? repetitions->insert(st->board_key(), st->hand, gamePly)
+                                  : RepetitionTable::NOT_INDEXED;
+
   // このタイミングで王手関係の情報を更新しておいてやる。
   set_check_info<false>(st);
+
+#if defined(EVAL_KPP)
+  // KKP/KPPの差分計算
+  if (Eval::KPP::enabled)
+    Eval::KPP::update_eval(*this, st);
+#endif
 }
 
 // 指し手で盤面を1手戻す。do_move()の逆変換。
@@ -875,6 +1235,10 @@ void Position::do_move(Move m, StateInfo &newSt, bool givesCheck) {
 
 // undo_move()を先後分けたdo_move_impl<>()を呼び出す。
 void Position::undo_move(Move m) {
+  // 千日手判定用の索引から現局面を取り除く。
+  if (repetitions)
+    repetitions->remove(st->board_key(), st->hand, st->repetitionPly);
+
   if (sideToMove == BLACK)
     undo_move_impl<WHITE>(
         m); // 1手前の手番が返らないとややこしいので入れ替えておく。
@@ -893,6 +1257,15 @@ void Position::do_null_move(StateInfo &newSt) {
 
   st->pliesFromNull = 0;
 
+  // null moveの局面は千日手判定用の索引には登録しない。(null moveより前の局面とは比較しないので不要)
+  st->repetitionPly = -1;
+
+#if defined(USE_DIRTY_PIECE)
+  // 盤面は変化しないので、評価関数の差分計算の情報は1つ前の局面のものをそのまま使える。
+  st->dirtyPiece.dirty_num = 0;
+  st->dirtyPiece.king_moved[BLACK] = st->dirtyPiece.king_moved[WHITE] = false;
+#endif
+
   sideToMove = ~sideToMove;
 
   set_check_info<true>(st);
@@ -909,7 +1282,122 @@ void Position::undo_null_move() {
 //      千日手判定
 // ----------------------------------
 
-RepetitionState Position::is_repetition(int repPly /* = 16 */) const {
+// i手前に同一局面(盤面と手駒が同じ)が出現しているときの千日手の種類を返す。
+// continuousCheckは現局面のStateInfo::continuousCheck。
+static RepetitionState same_position_state(const int continuousCheck[COLOR_NB], Color us, int i) {
+  // 自分が王手をしている連続王手の千日手なのか？
+  if (i <= continuousCheck[us])
+    return REPETITION_LOSE;
+
+  // 相手が王手をしている連続王手の千日手なのか？
+  if (i <= continuousCheck[~us])
+    return REPETITION_WIN;
+
+  // 先手側の負け
+  if (us == BLACK)
+    return REPETITION_LOSE;
+
+  // 後手側の勝ち
+  if (us == WHITE)
+    return REPETITION_WIN;
+
+  return REPETITION_DRAW; // error
+}
+
+RepetitionState Position::is_repetition() const {
+  // 索引がないとき、索引に登録できなかった局面があるときは、局面を遡って調べる。
+  if (!repetitions || repetitions->unindexed())
+    return is_repetition_by_scan(st->pliesFromNull);
+
+  // null moveより前の局面は調べない。
+  const int oldestPly = gamePly - st->pliesFromNull;
+
+  // 同一局面が前回出現していれば、その手数の差で連続王手の千日手かを判定する。
+  if (st->repetitionPly >= oldestPly)
+    return same_position_state(st->continuousCheck, sideToMove, gamePly - st->repetitionPly);
+
+  // 盤面が同じで手駒だけが違う局面があるか。(優等局面か劣等局面であるか)
+  // 盤面のhash keyには手番も含まれているので、相手番の局面は見つからない。
+  RepetitionState rs = REPETITION_NONE;
+  repetitions->for_each(st->board_key(), [&](const RepetitionTable::Entry &e) {
+    if (rs != REPETITION_NONE || e.hand == st->hand || e.lastPly < oldestPly)
+      return;
+    if (hand_is_equal_or_superior(st->hand, e.hand))
+      rs = REPETITION_SUPERIOR;
+    else if (hand_is_equal_or_superior(e.hand, st->hand))
+      rs = REPETITION_INFERIOR;
+  });
+  return rs;
+}
+
+RepetitionState Position::has_game_cycle() const {
+  // 1手で戻れるのは相手番の局面なので、3手前から奇数手前の局面を調べる。
+  const int end = std::min({st->pliesFromIrreversible, st->pliesFromNull, Cuckoo::MAX_CYCLE_PLY});
+  if (end < 3)
+    return REPETITION_NONE;
+
+  const Key originalKey = st->key();
+  const StateInfo *stp = st->previous;
+
+  for (int i = 3; i <= end; i += 2) {
+    stp = stp->previous->previous;
+
+    // 現局面からstpの局面に変化させる指し手があるか。
+    const Key moveKey = stp->key() - originalKey;
+    int j = Cuckoo::H1(moveKey);
+    if (Cuckoo::keys[j] != moveKey) {
+      j = Cuckoo::H2(moveKey);
+      if (Cuckoo::keys[j] != moveKey)
+        continue;
+    }
+
+    // その駒が移動元にあって、移動先と通り道が空いているなら指せる。
+    // 移動後の局面はstpの局面と同じで、そこでは自玉に王手がかかっていないので自殺手にはならない。
+    const Move move = Cuckoo::moves[j];
+    const Piece pc = moved_piece_after(move);
+    const Square from = move_from(move), to = move_to(move);
+    if (color_of(pc) != sideToMove || piece_on(from) != pc || piece_on(to) != NO_PIECE ||
+        (between_bb(from, to) & pieces()))
+      continue;
+
+    // 指したあとの局面の連続王手の手数。stpで相手に王手がかかっていれば、この指し手は王手である。
+    int continuousCheck[COLOR_NB];
+    continuousCheck[sideToMove] = stp->checkersBB ? st->continuousCheck[sideToMove] + 2 : 0;
+    continuousCheck[~sideToMove] = st->continuousCheck[~sideToMove];
+    return same_position_state(continuousCheck, ~sideToMove, i + 1);
+  }
+
+  return REPETITION_NONE;
+}
+
+void Position::set_repetition_table(RepetitionTable *table) {
+  repetitions = table;
+  if (table == nullptr)
+    return;
+
+  // StateInfoを遡れるところまで遡って、古い局面から順に登録し直す。
+  std::vector<StateInfo *> states;
+  for (StateInfo *si = st; si != nullptr; si = si->previous)
+    states.push_back(si);
+
+  table->clear();
+  int ply = gamePly - int(states.size()) + 1;
+  for (auto it = states.rbegin(); it != states.rend(); ++it, ++ply) {
+    StateInfo *si = *it;
+
+    // null moveの局面は登録しない。(do_null_move()を参照)
+    const int prevPly = (si->pliesFromNull == 0 && si->previous != nullptr)
+                            ? -1
+                            : table->insert(si->board_key(), si->hand, ply);
+
+    // rootまでのStateInfoは、他のスレッドのPositionと共有していることがある。
+    // 同じ局面の並びからは同じ値が求まるので、そのときは書き込まないようにしておく。
+    if (si->repetitionPly != prevPly)
+      si->repetitionPly = prevPly;
+  }
+}
+
+RepetitionState Position::is_repetition_by_scan(int repPly) const {
   // repPlyまで遡る
   // 現在の局面と同じhash
   // keyを持つ局面があれば、それは千日手局面であると判定する。
@@ -938,23 +1426,7 @@ RepetitionState Position::is_repetition(int repPly /* = 16 */) const {
     if (stp->board_key() == st->board_key()) {
       // 手駒が一致するなら同一局面である。(2手ずつ遡っているので手番は同じである)
       if (stp->hand == st->hand) {
-        // 自分が王手をしている連続王手の千日手なのか？
-        if (i <= st->continuousCheck[sideToMove])
-          return REPETITION_LOSE;
-
-        // 相手が王手をしている連続王手の千日手なのか？
-        if (i <= st->continuousCheck[~sideToMove])
-          return REPETITION_WIN;
-
-        // 先手側の負け
-        if (sideToMove == BLACK)
-          return REPETITION_LOSE;
-
-        // 後手側の勝ち
-        if (sideToMove == WHITE)
-          return REPETITION_WIN;
-
-        return REPETITION_DRAW; // error
+        return same_position_state(st->continuousCheck, sideToMove, i);
       } else {
         // 優等局面か劣等局面であるか。(手番が相手番になっている場合はいま考えない)
         if (hand_is_equal_or_superior(st->hand, stp->hand))
@@ -969,8 +1441,8 @@ RepetitionState Position::is_repetition(int repPly /* = 16 */) const {
   return REPETITION_NONE;
 }
 
-Move Position::reconstruct_move(uint16_t move16) const {
-  Move m = move_from16(move16);
+Move Position::reconstruct_move(Move16 move16) const {
+  Move m = Move(move16);
   if (m == MOVE_NONE)
     return MOVE_NONE;
 
@@ -1041,6 +1513,18 @@ bool Position::pos_is_ok() const {
   if (checkers() & pieces(side_to_move()))
     return false;
 
+#if defined(USE_EFFECT_BOARD)
+  // 7) 差分更新された利きの数は、盤面から求めたものと一致するか
+  {
+    StateInfo si;
+    set_effect(&si);
+    for (auto c : COLOR)
+      for (int i = 0; i < 4; ++i)
+        if (si.effect[c][i] != st->effect[c][i])
+          return false;
+  }
+#endif
+
   // 二歩のチェックなど云々かんぬん..面倒くさいので省略。
 
   return true;
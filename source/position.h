@@ -3,6 +3,17 @@
 
 #include "bitboard.h"
 
+#if defined(USE_DIRTY_PIECE)
+#include "bona_piece.h"
+#endif
+#if defined(EVAL_NNUE)
+#include "nnue.h"
+#endif
+#if defined(EVAL_KPP)
+#include "kpp.h"
+#endif
+
+#include <cstring>
 #include <deque>
 #include <memory> // std::unique_ptr
 
@@ -20,12 +31,55 @@ extern std::string SFEN_HIRATE;
 // StateInfoは、undo_move()で局面を戻すときに情報を元の状態に戻すのが面倒なものを詰め込んでおくための構造体。
 // do_move()のときは、ブロックコピーで済むのでそこそこ高速。
 struct StateInfo {
+  // do_move()で毎回書き込み、探索や千日手判定で毎回参照するものを先頭に集めて、
+  // 1つのキャッシュラインに収まるようにしてある。(effect以下はキャッシュラインをまたぐ)
+
+  // この局面のハッシュキー
+  // ※　次の局面にdo_move()で進むときに最終的な値が設定される
+  // board_key()は盤面のhash。hand_key()は手駒のhash。それぞれ加算したのがkey()
+  // 局面のhash。 board_key()のほうは、手番も込み。
+
+  Key board_key_;
+  Key hand_key_;
+
+  Key key() const { return board_key_ + hand_key_; }
+  Key board_key() const { return board_key_; }
+  Key hand_key() const { return hand_key_; }
+
+  // 一つ前の局面に遡るためのポインタ。
+  // この値としてnullptrが設定されているケースは、
+  // 1) root node
+  // 2) 直前がnull move
+  // のみである。
+  StateInfo *previous;
+
   // 遡り可能な手数(previousポインタを用いて局面を遡るときに用いる)
   int pliesFromNull;
 
+  // 直前の駒を取る指し手・駒打ち・成る指し手から何手経過したか。
+  // この間の局面は手駒と成駒が同じなので、駒を動かす指し手だけで互いに行き来できる。(has_game_cycle()で用いる)
+  int pliesFromIrreversible;
+
+  // この局面と同一の局面(盤面と手番側の手駒が同じ)が前回出現したときのgamePly。
+  // 初めて出現した局面なら-1。千日手判定用の索引(RepetitionTable)に登録できなかったときはRepetitionTable::NOT_INDEXED。
+  int repetitionPly;
+
   // この手番側の連続王手は何手前からやっているのか(連続王手の千日手の検出のときに必要)
   int continuousCheck[COLOR_NB];
 
+  // この局面における手番側の持ち駒。優等局面の判定のために必要。
+  Hand hand;
+
+  // この局面で捕獲された駒。先後の区別あり。
+  // ※　次の局面にdo_move()で進むときにこの値が設定される
+  Piece capturedPiece;
+
+  // 直前の指し手
+  Move lastMove;
+
+  // lastMoveで移動させた駒(先後の区別なし)
+  Piece lastMovedPieceType;
+
   // 現局面で手番側に対して王手をしている駒のbitboard
   Bitboard checkersBB;
 
@@ -39,40 +93,93 @@ struct StateInfo {
   // 自駒の駒種Xによって敵玉が王手となる升のbitboard
   Bitboard checkSquares[PIECE_WHITE];
 
-  // 直前の指し手
-  Move lastMove;
+#if defined(USE_EFFECT_BOARD)
+  // 各升に利いている先手/後手の駒の数。do_move()のときに差分更新される。
+  // undo_move()では1つ前のStateInfoに戻るだけで元の利きになる。
+  // 利きの数の第iビットを升ごとに並べたBitboardをeffect[c][i]に持つ。(bit-sliced)
+  // こうしておくと駒1枚分の利きの加減算がBitboard数回の論理演算で済む。
+  // 1つの升に利く駒は高々10枚なので4ビットあれば足りる。
+  Bitboard effect[COLOR_NB][4];
+#endif
 
-  // lastMoveで移動させた駒(先後の区別なし)
-  Piece lastMovedPieceType;
+#if defined(EVAL_KPP)
+  // KKP/KPPの各項の合計。do_move()のときに差分更新される。
+  Eval::KPP::EvalSum evalSum;
+#endif
 
-  // この局面のハッシュキー
-  // ※　次の局面にdo_move()で進むときに最終的な値が設定される
-  // board_key()は盤面のhash。hand_key()は手駒のhash。それぞれ加算したのがkey()
-  // 局面のhash。 board_key()のほうは、手番も込み。
+#if defined(USE_DIRTY_PIECE)
+  // do_move()で変化した駒。評価関数を1つ前の局面から差分計算するのに用いる。
+  Eval::DirtyPiece dirtyPiece;
+#endif
 
-  Key board_key_;
-  Key hand_key_;
+#if defined(EVAL_NNUE)
+  // NNUEの特徴変換層の出力。評価関数を呼び出したときに必要に応じて計算される。
+  // 大きいのでいちばん最後に置く。
+  Eval::NNUE::Accumulator accumulator;
+#endif
 
-  Key key() const { return board_key_ + hand_key_; }
-  Key board_key() const { return board_key_; }
-  Key hand_key() const { return hand_key_; }
+  void *operator new(std::size_t s);
+  void operator delete(void *p) noexcept;
+};
 
-  // この局面における手番側の持ち駒。優等局面の判定のために必要。
-  Hand hand;
+// --------------------
+//  千日手判定用の索引
+// --------------------
 
-  // この局面で捕獲された駒。先後の区別あり。
-  // ※　次の局面にdo_move()で進むときにこの値が設定される
-  Piece capturedPiece;
+// Position::set()で設定した局面から現局面までに出現した局面を、盤面のhash key(手番込み)と
+// 手番側の手駒の組で数えておく多重集合。do_move()で登録し、undo_move()で取り除く。
+// これにより、千日手の判定が手数によらずO(1)で済む。
+//
+// 盤面のhash keyだけで格納位置を決めて線形探索で並べるので、盤面が同じで手駒だけが違う局面
+// (優等局面・劣等局面)も同じ並びの中に見つかる。
+// 登録と削除は必ず逆順になるので、削除したエントリは単に空にすればよい。(後から登録されたもので
+// そのエントリを飛び越えて格納されたものは、すでに削除されている)
+class RepetitionTable {
+public:
+  // エントリ数(2の累乗)
+  static constexpr int SIZE = 1024;
 
-  // 一つ前の局面に遡るためのポインタ。
-  // この値としてnullptrが設定されているケースは、
-  // 1) root node
-  // 2) 直前がnull move
-  // のみである。
-  StateInfo *previous;
+  // 線形探索が長くならないように、これ以上の局面は登録しない。
+  static constexpr int MAX_ENTRIES = SIZE * 3 / 4;
 
-  void *operator new(std::size_t s);
-  void operator delete(void *p) noexcept;
+  // insert()で登録できなかったときに返す値
+  static constexpr int NOT_INDEXED = -2;
+
+  struct Entry {
+    Key boardKey;
+    Hand hand;
+
+    // この局面が最後に出現したときのgamePly
+    int lastPly;
+
+    // 出現回数。0なら空きエントリ。
+    int count;
+  };
+
+  void clear() { std::memset(this, 0, sizeof(*this)); }
+
+  // 局面を登録する。同一局面が前回出現したときのplyを返す。(初めてなら-1、登録できなければNOT_INDEXED)
+  int insert(Key boardKey, Hand hand, int ply);
+
+  // insert()の逆変換。prevPlyにはinsert()が返した値を渡す。
+  void remove(Key boardKey, Hand hand, int prevPly);
+
+  // 盤面がboardKeyである局面のエントリについてf(entry)を呼び出す。
+  template <typename F> void for_each(Key boardKey, F f) const {
+    for (size_t i = index(boardKey); entries[i].count; i = (i + 1) & (SIZE - 1))
+      if (entries[i].boardKey == boardKey)
+        f(entries[i]);
+  }
+
+  // 登録できなかった局面の数。0でなければ索引は不完全なので、局面を遡って調べる必要がある。
+  int unindexed() const { return unindexedCount; }
+
+private:
+  static size_t index(Key boardKey) { return size_t(boardKey >> 32) & (SIZE - 1); }
+
+  Entry entries[SIZE];
+  int used;
+  int unindexedCount;
 };
 
 // setup
@@ -145,12 +252,33 @@ public:
   Piece moved_piece_after(Move m) const { return Piece(m >> 16); }
 
   // 普通の千日手、連続王手の千日手等を判定する。
-  // そこまでの局面と同一局面であるかを、局面を遡って調べる。
-  // rep_ply : 遡る手数。デフォルトでは16手。あまり大きくすると速度低下を招く。
-  RepetitionState is_repetition(int rep_ply = 16) const;
-
-  // 置換表に保存された16bitの指し手を現在局面におけるMoveへ復元する
-  Move reconstruct_move(uint16_t move16) const;
+  // Position::set()の局面(null moveを挟んだときはその直後の局面)から現局面までに、同一局面があるかを
+  // 千日手判定用の索引(RepetitionTable)で調べる。手数によらずO(1)。
+  // 索引が設定されていないときは、局面を遡って調べる。
+  // 同一局面と、盤面が同じで手駒だけが違う局面の両方があるときは、同一局面のほうを優先して返す。
+  RepetitionState is_repetition() const;
+
+  // is_repetition()と同じ判定を、StateInfoをrep_ply手まで遡って調べる。(索引が使えないときと比較用)
+  // こちらは最も近い局面の結果を返す。
+  RepetitionState is_repetition_by_scan(int rep_ply) const;
+
+  // 手番側が次の1手(駒を取らず、成らない移動)で、以前に出現した局面に戻せるか。
+  // 戻せるなら、その1手を指した局面のis_repetition()の結果を返す。(手番は相手側になっていることに注意)
+  // 可逆な指し手のcuckoo hash tableを用いて、直前の駒取り・駒打ち・成りより後の局面だけを調べる。
+  // 全nodeで呼び出すので、遡るのは16手前(Cuckoo::MAX_CYCLE_PLY)までとする。それより前の局面に戻る手順は、
+  // 探索でその手順を指したときにis_repetition()で見つかる。
+  // 駒打ちや駒取りを挟んで手駒が元に戻った局面は見つけられないが、そのときはREPETITION_NONEを返すだけである。
+  RepetitionState has_game_cycle() const;
+
+  // 千日手判定用の索引としてtableを用いるようにする。現局面までの局面(StateInfoを遡れる範囲)を登録し直す。
+  // 索引は局面を進めるスレッドごとに用意すること。Positionをコピーすると索引も共有されてしまうので、
+  // 別のスレッドでコピーを用いるときは、そのスレッドの索引を設定し直すこと。
+  // set()を呼び出すと索引は外れる。(nullptrになる)
+  void set_repetition_table(RepetitionTable *table);
+
+  // 16bit形式の指し手(置換表やkillerに保存されているもの)に、移動させる駒を補って現在局面におけるMoveへ復元する。
+  // 移動元に手番側の駒がなければMOVE_NONEを返す。
+  Move reconstruct_move(Move16 move16) const;
 
   // --- Bitboard
 
@@ -273,7 +401,11 @@ public:
   // attackers_to()で駒があればtrueを返す版。(利きの情報を持っているなら、軽い実装に変更できる)
   // kingSqの地点からは玉を取り除いての利きの判定を行なう。
   bool effected_to(Color c, Square sq) const {
+#if defined(USE_EFFECT_BOARD)
+    return effected_bb(c) & sq;
+#else
     return attackers_to(c, sq, pieces());
+#endif
   }
   bool effected_to(Color c, Square sq, Square kingSq) const {
     return attackers_to(c, sq, pieces() ^ kingSq);
@@ -348,6 +480,17 @@ public:
                   !legal_drop(to)))); // 打ち歩詰め
   }
 
+  // --- SEE(静的交換評価)
+
+  // 指し手mのあと、升toで駒を取り合ったときの駒の損得を手番側から見た値で返す。
+  // 取り合いはお互いに価値の低い駒から順に行い、損になるならどちらもいつでも取り合いをやめられるものとする。
+  // 駒の価値は盤上の駒の価値(Eval::PieceValue)と手駒になったときの価値の和。成れる駒は成るものとする。
+  // pinされている駒も取り合いに参加させる。(厳密ではないが速度優先)
+  Value see(Move m) const;
+
+  // see(m) >= thresholdであるか。損得が確定した時点で打ち切るので、see()より速い。
+  bool see_ge(Move m, Value threshold = VALUE_ZERO) const;
+
   // --- StateInfo
 
   // 現在の局面に対応するStateInfoを返す。
@@ -367,6 +510,30 @@ public:
   // StateInfo::key()への簡易アクセス。
   Key key() const { return st->key(); }
 
+#if defined(USE_EFFECT_BOARD)
+  // --- 利き
+
+  // 升sqに利いているc側の駒の数を返す。
+  int effect_count(Color c, Square sq) const {
+    const Bitboard *e = st->effect[c];
+    return int((e[0].p >> sq) & 1) | int((e[1].p >> sq) & 1) << 1 |
+           int((e[2].p >> sq) & 1) << 2 | int((e[3].p >> sq) & 1) << 3;
+  }
+
+  // c側の利きのある升のBitboard
+  Bitboard effected_bb(Color c) const {
+    const Bitboard *e = st->effect[c];
+    return e[0] | e[1] | e[2] | e[3];
+  }
+
+  // c側の利きが1つ以上ある升をone、2つ以上ある升をtwoに返す。(評価関数用)
+  void effect_count_bb(Color c, Bitboard &one, Bitboard &two) const {
+    const Bitboard *e = st->effect[c];
+    two = e[1] | e[2] | e[3];
+    one = e[0] | two;
+  }
+#endif
+
   // --- misc
 
   // 現局面で王手がかかっているか
@@ -418,6 +585,17 @@ private:
   // このクラスが保持しているkingSquare[]の更新
   void update_kingSquare();
 
+#if defined(USE_EFFECT_BOARD)
+  // 盤上の駒すべての利きを数えてsi->effectを初期化する。set_state()から呼び出される。
+  void set_effect(StateInfo *si) const;
+
+  // do_move()で盤面を更新したあとに呼び出して、fromが空いたこと・toが埋まったことによる
+  // 大駒の利きの変化をsi->effectに反映させる。old_occは移動前のoccupied bitboard。駒打ちならfrom == to。
+  // toに移動してきた駒の利きは呼び出し元で処理するので除外する。
+  void update_slider_effect(StateInfo *si, Square from, Square to,
+                            const Bitboard &old_occ) const;
+#endif
+
   // 盤面、25升分の駒
   Piece board[SQ_NB];
 
@@ -434,8 +612,51 @@ private:
   int gamePly;
 
   StateInfo *st;
+
+  // 千日手判定用の索引。set_repetition_table()で設定し、do_move()/undo_move()で更新する。
+  // nullptrなら索引は用いずに、局面を遡って調べる。
+  RepetitionTable *repetitions;
 };
 
+inline int RepetitionTable::insert(Key boardKey, Hand hand, int ply) {
+  for (size_t i = index(boardKey);; i = (i + 1) & (SIZE - 1)) {
+    Entry &e = entries[i];
+    if (e.count == 0) {
+      if (used >= MAX_ENTRIES) {
+        ++unindexedCount;
+        return NOT_INDEXED;
+      }
+      e = Entry{boardKey, hand, ply, 1};
+      ++used;
+      return -1;
+    }
+    if (e.boardKey == boardKey && e.hand == hand) {
+      const int prevPly = e.lastPly;
+      e.lastPly = ply;
+      ++e.count;
+      return prevPly;
+    }
+  }
+}
+
+inline void RepetitionTable::remove(Key boardKey, Hand hand, int prevPly) {
+  if (prevPly == NOT_INDEXED) {
+    --unindexedCount;
+    return;
+  }
+  for (size_t i = index(boardKey);; i = (i + 1) & (SIZE - 1)) {
+    Entry &e = entries[i];
+    ASSERT_LV3(e.count != 0);
+    if (e.boardKey == boardKey && e.hand == hand) {
+      if (--e.count == 0)
+        --used;
+      else
+        e.lastPly = prevPly;
+      return;
+    }
+  }
+}
+
 inline void Position::xor_piece(Square sq, Piece pc) {
   // 先手・後手の駒のある場所を示すoccupied bitboardの更新
   byColorBB[color_of(pc)] ^= sq;
@@ -1,4 +1,5 @@
 ﻿#include <algorithm>
+#include <cstring>
 #include <thread>
 
 #include "evaluate.h"
@@ -14,6 +15,7 @@ struct MovePicker {
       endMoves = generateMoves<EVASIONS>(pos, currentMoves);
     else
       endMoves = generateMoves<RECAPTURES>(pos, currentMoves, recapSq);
+    ASSERT_LV3(endMoves <= moves + MAX_MOVES);
   }
 
   Move nextMove() {
@@ -27,6 +29,13 @@ private:
   ExtMove moves[MAX_MOVES], *currentMoves = moves, *endMoves = moves;
 };
 
+// 探索の統計を数える文。USE_SEARCH_STATSが定義されていなければ何もしない。
+#if defined(USE_SEARCH_STATS)
+#define STATS(X) X
+#else
+#define STATS(X)
+#endif
+
 namespace Search {
 // 探索開始局面で思考対象とする指し手の集合。
 RootMoves rootMoves;
@@ -34,8 +43,8 @@ RootMoves rootMoves;
 // 持ち時間設定など。
 LimitsType Limits;
 
-// 今回のgoコマンドでの探索ノード数。
-std::atomic<uint64_t> Nodes{0};
+// 探索スレッドの状態
+SearchThreads Threads;
 
 // 探索中にこれがtrueになったら探索を即座に終了すること。
 std::atomic<bool> Stop{false};
@@ -43,31 +52,288 @@ std::atomic<bool> Stop{false};
 // 並列探索マネージャー
 std::unique_ptr<ParallelSearchManager> parallelManager;
 
+#if defined(USE_SEARCH_STATS)
+// 反復深化の各反復が終わった時点での探索ノード数(全スレッドの合計)。[0]が深さ1。
+std::vector<uint64_t> IterationNodes;
+#endif
+
 } // namespace Search
 
-// 起動時に呼び出される。時間のかからない探索関係の初期化処理はここに書くこと。
-void Search::init() {
-#ifdef USE_TRANSPOSITION_TABLE
-  // 置換表を初期化
-  TT.resize(DEFAULT_TT_SIZE);
+namespace {
+
+// --- 指し手オーダリングに用いるテーブル(SearchThread::killers, history)
+
+// historyは、駒を取らない指し手でbetaカットが起きたときにその指し手を加点し、それより先に調べた
+// 駒を取らない指し手を減点する。
+constexpr int HISTORY_MAX = 1 << 13;
+
+// historyにbonusを加える。値の絶対値がHISTORY_MAXを超えないように、大きな値ほど動きにくくしてある。
+void update_history(Search::SearchThread &th, Color c, Move m, int bonus) {
+  int16_t &h = th.history[c][from_to(m)];
+  h += bonus - h * std::abs(bonus) / HISTORY_MAX;
+}
+
+// 複数のスレッドでの探索の方法(USIオプションのParallelMode)。start_thinking()で設定する。
+enum class ParallelMode { Off, LazySMP, RootSplit, ABDADA };
+ParallelMode parallelMode = ParallelMode::Off;
+
+// --- ABDADA
+// 各スレッドは残り深さがABDADA_MIN_DEPTH以上のnodeを探索している間、そのnodeのhash keyを表(breadcrumbs)に置いておく。
+// 2手目以降の指し手で、他のスレッドが探索中の子nodeに進むときは、その指し手を後回しにして他の指し手を先に調べる。
+// 後回しにした指し手は、他の指し手を調べ終えてから探索する。(その頃には置換表に結果が入っていることが多い)
+// 表はhash keyで引く固定長のもので、衝突したときは登録しない。(後回しにしないだけで、探索の結果は変わらない)
+
+// 探索中のnodeを後回しにするか。search()で設定する。
+bool useAbdada = false;
+
+constexpr int ABDADA_MIN_DEPTH = 2;
+
+struct Breadcrumb {
+  std::atomic<uint32_t> owner{0}; // 探索中のスレッドの番号 + 1。0なら空き。
+  std::atomic<Key> key{0};
+};
+constexpr size_t BREADCRUMB_NB = 1024;
+Breadcrumb breadcrumbs[BREADCRUMB_NB];
+
+// keyのnodeを探索中であることを、スコープを抜けるまで表に置いておく。
+class BreadcrumbGuard {
+public:
+  BreadcrumbGuard(bool enabled, Key key, size_t thread_id) {
+    if (!enabled)
+      return;
+    Breadcrumb &b = breadcrumbs[key & (BREADCRUMB_NB - 1)];
+    uint32_t expected = 0;
+    if (b.owner.compare_exchange_strong(expected, uint32_t(thread_id + 1), std::memory_order_relaxed)) {
+      b.key.store(key, std::memory_order_relaxed);
+      entry = &b;
+    }
+  }
+
+  ~BreadcrumbGuard() {
+    if (entry) {
+      entry->key.store(0, std::memory_order_relaxed);
+      entry->owner.store(0, std::memory_order_release);
+    }
+  }
+
+private:
+  Breadcrumb *entry = nullptr;
+};
+
+// 他のスレッドがkeyのnodeを探索中か
+bool being_searched(Key key, size_t thread_id) {
+  const Breadcrumb &b = breadcrumbs[key & (BREADCRUMB_NB - 1)];
+  const uint32_t owner = b.owner.load(std::memory_order_relaxed);
+  return owner != 0 && owner != thread_id + 1 && b.key.load(std::memory_order_relaxed) == key;
+}
+
+// 指し手オーダリングのスコア。(killer以外の駒を取らない指し手はhistoryの値)
+constexpr int32_t ORDER_TT_MOVE = 1 << 30;
+constexpr int32_t ORDER_GOOD_CAPTURE = 1 << 20;
+constexpr int32_t ORDER_KILLER = 1 << 16;
+
+// 駒を取る指し手か
+bool is_capture(const Position &pos, Move m) {
+  return !is_drop(m) && pos.piece_on(move_to(m)) != NO_PIECE;
+}
+
+// [begin, end)をvalueの降順に並べ替える。指し手の数は少ないので挿入ソートで十分。
+// 同じvalueの指し手は生成順のままにする。
+void sort_moves(ExtMove *begin, ExtMove *end) {
+  for (ExtMove *p = begin + 1; p < end; ++p) {
+    ExtMove tmp = *p, *q;
+    for (q = p; q != begin && (q - 1)->value < tmp.value; --q)
+      *q = *(q - 1);
+    *q = tmp;
+  }
+}
+
+// LazySMP, ABDADAでの、反復の深さごとのrootの評価値の下限。(どれかのスレッドがその深さで求めたrootの指し手の値の最大)
+// 補助スレッドはこれを下限とする窓でrootの指し手を探索して、すでに分かっている値より悪い指し手の値を詳しく求めない。
+// (RootSplitのsharedAlphaと同じ考え方で、こちらは反復の深さが揃わないので深さごとに持つ)
+std::atomic<int> rootAlpha[MAX_PLY + 1];
+
+std::atomic<int> &root_alpha(int depth) { return rootAlpha[std::min(depth, MAX_PLY)]; }
+
+// 深さdepthの反復で、rootの指し手の値がvalueと分かったので下限を引き上げる。
+void raise_root_alpha(int depth, Value value) {
+  std::atomic<int> &a = root_alpha(depth);
+  int current = a.load(std::memory_order_relaxed);
+  while (value > current && !a.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    ;
+}
+
+// LazySMP, ABDADAの補助スレッドの探索。
+// 通常の反復深化と同じようにrootの指し手を順に探索するが、結果は置換表に残すだけで用いない。
+// 探索窓の下限はrootAlphaから取り、窓の中の値が求まったらrootAlphaを引き上げる。
+// LazySMPでは補助スレッドどうしで同じ深さを探索しないように、奇数番のスレッドは1手深い反復から始める。
+// (ABDADAでは同じ深さを探索して、探索中の子nodeを後回しにすることで仕事を分け合う)
+void helper_search(Search::SearchThread &th, int maxDepth, bool skipDepth) {
+  using namespace Search;
+  Position &pos = *th.pos;
+
+  // rootMovesは通常の反復深化が並べ替えるので、指し手は自分で生成する。
+  std::vector<Move> moves;
+  for (Move move : MoveList<LEGAL>(pos))
+    moves.push_back(move);
+
+  for (int depth = 1 + (skipDepth ? int(th.id % 2) : 0); depth <= maxDepth && !Stop; ++depth)
+    for (Move move : moves) {
+      const Value alpha = Value(root_alpha(depth).load(std::memory_order_relaxed));
+      pos.do_move(move, th.states[0]);
+      const RepetitionState repetitionState = pos.is_repetition();
+      const Value value =
+          repetitionState != REPETITION_NONE
+              ? -draw_value(repetitionState, pos.side_to_move())
+              : (-1) * alphabeta_search(th, th.pvs[1], -VALUE_INFINITE, -alpha, depth - 1, 1);
+      pos.undo_move(move);
+      if (Stop)
+        break;
+      if (is_valid_value(value) && value > alpha)
+        raise_root_alpha(depth, value);
+    }
+}
+
+} // namespace
+
+// SearchThreadの実装
+void Search::SearchThread::set_root(const Position &rootPos) {
+  pos = std::make_unique<Position>(rootPos);
+  pos->set_repetition_table(&repetitions);
+}
+
+void Search::SearchThread::clear() {
+  std::memset(history, 0, sizeof(history));
+}
+
+// SearchThreadsの実装
+void Search::SearchThreads::set_size(size_t n) {
+  threads.reserve(n);
+  while (threads.size() < n)
+    threads.emplace_back(std::make_unique<SearchThread>(threads.size()));
+  threads.resize(n);
+}
+
+uint64_t Search::SearchThreads::nodes_searched() const {
+  uint64_t nodes = 0;
+  for (const auto &th : threads)
+    nodes += th->nodes.nodes.load(std::memory_order_relaxed);
+  return nodes;
+}
+
+void Search::SearchThreads::reset_nodes() {
+  for (auto &th : threads)
+    th->nodes.nodes.store(0, std::memory_order_relaxed);
+}
+
+void Search::print_stats() {
+#if defined(USE_SEARCH_STATS)
+  // 割合(%)と平均。分母が0なら0にしておく。
+  auto percent = [](uint64_t a, uint64_t b) { return b ? 100.0 * a / b : 0.0; };
+  auto average = [](uint64_t a, uint64_t b) { return b ? double(a) / b : 0.0; };
+
+  auto add = [](SearchStats::Ply &s, const SearchStats::Ply &x) {
+    s.interior += x.interior;
+    s.leaf += x.leaf;
+    s.betaCutoffs += x.betaCutoffs;
+    s.firstMoveCutoffs += x.firstMoveCutoffs;
+    s.ttMoveCutoffs += x.ttMoveCutoffs;
+    s.movesBeforeCutoff += x.movesBeforeCutoff;
+    s.abdadaDeferred += x.abdadaDeferred;
+    for (int i = 0; i < SearchStats::PRUNE_NB; ++i)
+      s.pruned[i] += x.pruned[i];
+  };
+
+  // 全手数の値を足し合わせる。
+  auto sum_ply = [&](const SearchStats &st) {
+    SearchStats::Ply s{};
+    for (const auto &x : st.ply)
+      add(s, x);
+    return s;
+  };
+
+  auto print = [&](const std::string &label, const SearchStats::Ply &s) {
+    std::cout << "info string " << label << " interior " << s.interior << " leaf " << s.leaf
+              << " cutoffs " << s.betaCutoffs << " first " << percent(s.firstMoveCutoffs, s.betaCutoffs)
+              << "% ttmove " << percent(s.ttMoveCutoffs, s.betaCutoffs) << "% moves/cutoff "
+              << average(s.movesBeforeCutoff, s.betaCutoffs) << " pruned repetition "
+              << s.pruned[SearchStats::PRUNE_REPETITION] << " tt " << s.pruned[SearchStats::PRUNE_TT]
+              << " cycle " << s.pruned[SearchStats::PRUNE_CYCLE] << " mate1 "
+              << s.pruned[SearchStats::PRUNE_MATE1] << " mate3 " << s.pruned[SearchStats::PRUNE_MATE3]
+              << " deferred " << s.abdadaDeferred << std::endl;
+  };
+
+  // 全スレッドの合計
+  SearchStats total;
+  total.clear();
+  for (size_t i = 0; i < Threads.size(); ++i)
+    for (int p = 0; p <= MAX_PLY; ++p)
+      add(total.ply[p], Threads[i].stats.ply[p]);
+
+  std::cout << "info string nodes " << nodes_searched() << " threads " << Threads.size() << std::endl;
+  print("total", sum_ply(total));
+
+  // スレッドごと
+  if (Threads.size() > 1)
+    for (size_t i = 0; i < Threads.size(); ++i)
+      print("thread " + std::to_string(i), sum_ply(Threads[i].stats));
+
+  // 手数ごと(nodeのあった手数のみ)
+  for (int p = 0; p <= MAX_PLY; ++p) {
+    const SearchStats::Ply &s = total.ply[p];
+    if (s.interior + s.leaf + s.pruned[SearchStats::PRUNE_TT] + s.pruned[SearchStats::PRUNE_REPETITION])
+      print("ply " + std::to_string(p), s);
+  }
+
+  // 反復ごとの探索ノード数と実効分岐係数
+  //   ebf            : その反復のノード数 / 1つ前の反復のノード数
+  //   cumulative ebf : その反復までの合計ノード数 / 1つ前の反復までの合計ノード数
+  // (置換表の深さの判定を緩めているので、奇数の反復は置換表だけで終わることが多く、ebfは反復ごとに大きく振れる)
+  for (size_t d = 0; d < IterationNodes.size(); ++d) {
+    const uint64_t n = IterationNodes[d] - (d ? IterationNodes[d - 1] : 0);
+    const uint64_t prev = d ? IterationNodes[d - 1] - (d > 1 ? IterationNodes[d - 2] : 0) : 0;
+    std::cout << "info string depth " << d + 1 << " nodes " << n << " ebf " << average(n, prev)
+              << " cumulative ebf " << average(IterationNodes[d], d ? IterationNodes[d - 1] : 0)
+              << std::endl;
+  }
+#else
+  std::cout << "info string searchstats is not available. (define USE_SEARCH_STATS in config.h)"
+            << std::endl;
 #endif
+}
 
-  // 並列探索マネージャーの初期化
-  parallelManager = std::make_unique<ParallelSearchManager>();
-  parallelManager->initialize();
+// 起動時に呼び出される。時間のかからない探索関係の初期化処理はここに書くこと。
+// 対局ごとにエンジンを起動することがあるので、置換表の確保やスレッドの起動はここではなくclear()で行う。
+void Search::init() {
 }
 
 // isreadyコマンドの応答中に呼び出される。時間のかかる処理はここに書くこと。
 void Search::clear() {
+  // 並列探索マネージャーのクリア。最初のisreadyのときに初期化する。
+  // (スレッドプールのワーカーもここで起動するので、置換表のクリアより先に行う)
+  // goコマンドを処理するスレッドも探索に加わるので、ワーカーはThreadsより1つ少なくてよい。
+  if (parallelManager)
+    parallelManager->stop_all_searches();
+  else
+    parallelManager = std::make_unique<ParallelSearchManager>();
+  parallelManager->initialize(size_t((int)Options["Threads"]) - 1);
+  Threading::Pool.set_affinity((bool)(int)Options["ThreadAffinity"], size_t((int)Options["ThreadAffinityBase"]));
+
 #ifdef USE_TRANSPOSITION_TABLE
-  // 置換表をクリア
+  // 置換表を確保してクリア(最初のisreadyのときに確保される)
+  TT.resize(DEFAULT_TT_SIZE);
   TT.clear();
 #endif
 
-  // 並列探索マネージャーのクリア
-  if (parallelManager) {
-    parallelManager->stop_all_searches();
-  }
+#ifdef USE_MATE_3PLY
+  // 3手詰め判定のハッシュをクリア
+  Mate::clear_mate_hash();
+#endif
+
+  // historyのクリア(全探索スレッドの分)
+  Threads.set_size(Threading::Pool.size() + 1);
+  for (size_t i = 0; i < Threads.size(); ++i)
+    Threads[i].clear();
 }
 
 // 同じ関数名で引数が異なる関数をオーバーロードという。
@@ -80,33 +346,51 @@ void Search::start_thinking(const Position &rootPos, StateListPtr &states,
                             LimitsType limits) {
   Limits = limits;
   rootMoves.clear();
-  Nodes = 0;
   Stop = false;
 
-  for (Move move : MoveList<LEGAL_ALL>(rootPos))
+  const std::string mode = Options["ParallelMode"];
+  parallelMode = mode == "LazySMP"   ? ParallelMode::LazySMP
+               : mode == "RootSplit" ? ParallelMode::RootSplit
+               : mode == "ABDADA"    ? ParallelMode::ABDADA
+                                     : ParallelMode::Off;
+
+  // 通常探索はこのスレッドで行うので、0番の状態を用いる。
+  // (プールのワーカーの数がisreadyのあとに変わっていることがあるので、ここでも合わせておく)
+  Threads.set_size(Threading::Pool.size() + 1);
+  Threads.reset_nodes();
+#if defined(USE_SEARCH_STATS)
+  for (size_t i = 0; i < Threads.size(); ++i)
+    Threads[i].stats.clear();
+  IterationNodes.clear();
+#endif
+
+  // 角・飛の不成は成りに劣るので、探索では生成しない。
+  for (Move move : MoveList<LEGAL>(rootPos))
     rootMoves.emplace_back(move);
 
   ASSERT_LV3(states.get());
 
-  Position *pos_ptr = const_cast<Position *>(&rootPos);
-
-  // 並列探索の開始
-  // if (parallelManager) {
-  //   int mate_depth = Mate::Utils::calculate_mate_depth(
-  //       Limits.time[rootPos.side_to_move()],
-  //       Limits.use_time_management() ? 20 : 10
-  //   );
-  //   parallelManager->start_parallel_search(*pos_ptr,
-  //       Limits.depth ? Limits.depth : 20,
-  //       Limits.byoyomi[rootPos.side_to_move()]
-  //   );
-  // }
-
-  search(*pos_ptr);
+  // 探索はrootPosのコピーで行う。対局開始からの局面はコピーの千日手判定用の索引に登録される。
+  SearchThread &th = Threads[0];
+  th.set_root(rootPos);
+
+  // 詰み探索スレッドの開始
+  // 通常探索と並行して、rootPosのコピーで詰みを探す。
+  if (parallelManager && rootMoves.size() > 0) {
+    const Color us = rootPos.side_to_move();
+    parallelManager->start_parallel_search(*th.pos,
+        Limits.depth ? Limits.depth : 20,
+        Limits.byoyomi[us] + Limits.time[us]
+    );
+  }
+
+  search(th);
 }
 
 // 探索本体
-void Search::search(Position &pos) {
+void Search::search(SearchThread &th) {
+  Position &pos = *th.pos;
+
   // 探索で返す指し手
   Move bestMove = MOVE_RESIGN;
 
@@ -124,6 +408,9 @@ void Search::search(Position &pos) {
     TT.new_search();
 #endif
 
+    // killerは前回の探索の局面とは関係がないのでクリアしておく。
+    std::memset(th.killers, 0, sizeof(th.killers));
+
     /* 時間制御 */
     Color us = pos.side_to_move();
     std::thread *timerThread = nullptr;
@@ -139,7 +426,7 @@ void Search::search(Position &pos) {
     if (Limits.use_time_management()) {
       timerThread = new std::thread([&] {
         while (Time.elapsed() < endTime && !Stop)
-          std::this_thread::sleep_for(std::chrono::milliseconds(9900));
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
         Stop = true;
       });
     }
@@ -149,104 +436,125 @@ void Search::search(Position &pos) {
     Value alpha = -VALUE_INFINITE;
     Value beta = VALUE_INFINITE;
     
-    StateInfo si;
     int maxDepth = Limits.depth ? Limits.depth : 20; // goコマンドで指定された深さ、なければ20
 
-    // 反復深化探索
-    int depth;
-    for (depth = 1; depth <= maxDepth && !Stop; ++depth) {
-      // ノード数制限のチェック
-      if (Limits.nodes && Nodes >= (uint64_t)Limits.nodes) {
-        Stop = true;
-        break;
+    // 複数のスレッドで探索するなら、他のスレッドにもrootの局面を設定しておく。
+    // (探索中にこのスレッドのposから作ると、do_move()の途中の局面をコピーしてしまう)
+    const ParallelMode mode = Threads.size() > 1 ? parallelMode : ParallelMode::Off;
+    if (mode != ParallelMode::Off)
+      for (size_t i = 1; i < Threads.size(); ++i) {
+        Threads[i].set_root(pos);
+        std::memset(Threads[i].killers, 0, sizeof(Threads[i].killers));
       }
-      Value currentMaxValue = -VALUE_INFINITE;
-      Move currentBestMove = MOVE_NONE;
-
-      // 並列探索で各合法手について探索
-      /*if (parallelManager && rootMoves.size() > 1 && depth >= 3) {
-        // 並列探索（3手目以降、複数の合法手がある場合）
-        parallelManager->search_root_moves_parallel(pos, depth, alpha, beta);
-
-        // 並列探索の結果からbestMoveを更新
-        for (size_t i = 0; i < rootMoves.size(); ++i) {
-          if(chmax(currentMaxValue, rootMoves[i].score)) {
-            currentBestMove = rootMoves[i].pv[0];
-          }
-        }
 
-        // 評価値順にrootMovesをソート
-        std::stable_sort(rootMoves.begin(), rootMoves.end());
-        std::cout << USI::pv(pos, depth) << std::endl;
-
-        // 詰み探索結果のチェック
-        if (parallelManager->check_mate_result()) {
-          break; // 詰みが見つかったので探索終了
+    // 反復深化探索
+    int depth = 1;
+    auto iterative_deepening = [&]() {
+      for (depth = 1; depth <= maxDepth && !Stop; ++depth) {
+        // ノード数制限のチェック
+        if (Limits.nodes && nodes_searched() >= (uint64_t)Limits.nodes) {
+          Stop = true;
+          break;
         }
-      } else*/ {
-        // 逐次探索（従来通り）
-        for (size_t i = 0; i < rootMoves.size(); ++i) {
-          Move move = rootMoves[i].pv[0];           // 合法手のi番目
-          pos.do_move(move, si);                    // 局面を1手進める
-          Value value = VALUE_NONE;
-          std::vector<Move> pv;
-          // 千日手(5五将棋ルール)は種類ごとの評価値で返す
-          // pos.do_move()しているため、評価値の符号に注意
-          const RepetitionState &repetitionState = pos.is_repetition(16);
-          if (repetitionState != REPETITION_NONE) {
-            value = -draw_value(repetitionState, pos.side_to_move());
-          } else {
-            // 1手進めた状態で探索を行っているため、ply_from_rootは1
-            value = (-1) * alphabeta_search(pos, pv, alpha, beta, depth-1, 1); // 指定深さで探索
-          }
-          const bool valid = is_valid_value(value);
-          if (valid) {
-            rootMoves[i].pv.clear();
-            rootMoves[i].pv.emplace_back(move);
-            if (!pv.empty()) {
-              rootMoves[i].pv.insert(rootMoves[i].pv.end(), pv.begin(), pv.end());
+        Value currentMaxValue = -VALUE_INFINITE;
+        Move currentBestMove = MOVE_NONE;
+
+        if (mode == ParallelMode::RootSplit && rootMoves.size() > 1 && depth >= 2) {
+          // rootの指し手をスレッドで分け合って探索する。最善手はrootMovesの先頭に並べられる。
+          parallelManager->search_root_moves_parallel(th, depth, alpha, beta);
+          if (is_valid_value(rootMoves[0].score)) {
+            currentMaxValue = rootMoves[0].score;
+            currentBestMove = pos.reconstruct_move(rootMoves[0].pv[0]);
+          }
+          std::cout << USI::pv(pos, depth) << std::endl;
+        } else {
+          // 逐次探索（従来通り）
+          for (size_t i = 0; i < rootMoves.size(); ++i) {
+            Move move = pos.reconstruct_move(rootMoves[i].pv[0]); // 合法手のi番目
+            pos.do_move(move, th.states[0]);          // 局面を1手進める
+            Value value = VALUE_NONE;
+            PVLine &pv = th.pvs[1];
+            pv.clear();
+            // 千日手(5五将棋ルール)は種類ごとの評価値で返す
+            // pos.do_move()しているため、評価値の符号に注意
+            const RepetitionState &repetitionState = pos.is_repetition();
+            if (repetitionState != REPETITION_NONE) {
+              value = -draw_value(repetitionState, pos.side_to_move());
+            } else {
+              // 1手進めた状態で探索を行っているため、ply_from_rootは1
+              value = (-1) * alphabeta_search(th, pv, alpha, beta, depth-1, 1); // 指定深さで探索
+            }
+            const bool valid = is_valid_value(value);
+            if (valid) {
+              // 補助スレッドの探索窓の下限にする。(この探索は全幅の窓なので、値は正確である)
+              raise_root_alpha(depth, value);
+              rootMoves[i].pv.clear();
+              rootMoves[i].pv.emplace_back(to_move16(move));
+              if (!pv.empty()) {
+                rootMoves[i].pv.insert(rootMoves[i].pv.end(), pv.begin(), pv.end());
+              }
+              rootMoves[i].score = value;
+              rootMoves[i].selDepth = depth;
+            } else {
+              // 無効値なら最新手だけ記録し、スコアは極端に低くして並び替え対象から外す
+              rootMoves[i].pv.clear();
+              rootMoves[i].pv.emplace_back(to_move16(move));
+              rootMoves[i].score = -VALUE_INFINITE;
+              rootMoves[i].selDepth = depth;
             }
-            rootMoves[i].score = value;
-            rootMoves[i].selDepth = depth;
-          } else {
-            // 無効値なら最新手だけ記録し、スコアは極端に低くして並び替え対象から外す
-            rootMoves[i].pv.clear();
-            rootMoves[i].pv.emplace_back(move);
-            rootMoves[i].score = -VALUE_INFINITE;
-            rootMoves[i].selDepth = depth;
-          }
 
-          pos.undo_move(move);
+            pos.undo_move(move);
 
-          if(!valid)
-            continue;
+            if(!valid)
+              continue;
 
-          if(chmax(currentMaxValue, value)) {
-            currentBestMove = move;
+            if(chmax(currentMaxValue, value)) {
+              currentBestMove = move;
+            }
+            // [TODO] debug ソートが多すぎるので本来は深化するごとに一回だけ
+            // 評価値順にrootMovesをソート
+            std::stable_sort(rootMoves.begin(), rootMoves.begin()+i+1);
+            std::cout << USI::pv(pos, depth) << std::endl;
           }
-          // [TODO] debug ソートが多すぎるので本来は深化するごとに一回だけ
-          // 評価値順にrootMovesをソート
-          std::stable_sort(rootMoves.begin(), rootMoves.begin()+i+1);
-          std::cout << USI::pv(pos, depth) << std::endl;
         }
-      }
       
-      if (currentMaxValue > maxValue) {
-        maxValue = currentMaxValue;
-        bestMove = currentBestMove;
+        if (currentMaxValue > maxValue) {
+          maxValue = currentMaxValue;
+          bestMove = currentBestMove;
+        }
+        STATS(if (!Stop) IterationNodes.push_back(nodes_searched()));
       }
-    }
+      // Stopを立てて、LazySMP, ABDADAの補助スレッドを終わらせる。
+      Stop = true;
+    };
+
+    useAbdada = mode == ParallelMode::ABDADA;
+    for (auto &a : rootAlpha)
+      a.store(-VALUE_INFINITE, std::memory_order_relaxed);
+    if (mode == ParallelMode::LazySMP || mode == ParallelMode::ABDADA) {
+      // 0番のジョブ(このスレッドで実行される)が通常の反復深化を行い、他のジョブは補助スレッドとして
+      // 同じ局面を探索し、置換表を埋める。通常の反復深化が終わると補助スレッドも終わる。
+      Threading::Pool.run_custom_jobs([&](size_t id) {
+        if (id == 0)
+          iterative_deepening();
+        else
+          helper_search(Threads[id], maxDepth, mode == ParallelMode::LazySMP);
+      });
+    } else
+      iterative_deepening();
     /* 探索終了 */
 
     // 並列探索の停止
+    // 詰み探索スレッドが詰みを見つけていれば、その結果をrootMovesに反映する。
     if (parallelManager) {
       parallelManager->stop_all_searches();
+      parallelManager->check_mate_result();
     }
 
     // 最終ソートとbestMove更新
     std::stable_sort(rootMoves.begin(), rootMoves.end());
     std::cout << USI::pv(pos, depth) << std::endl;
-    bestMove = rootMoves[0].pv[0];  // ソート済みの先頭が最善手
+    bestMove = pos.reconstruct_move(rootMoves[0].pv[0]);  // ソート済みの先頭が最善手
 
     // タイマースレッド終了
     Stop = true;
@@ -263,17 +571,34 @@ END:;
 }
 
 // アルファ・ベータ法(alpha-beta method)
-Value Search::alphabeta_search(Position &pos, std::vector<Move> &pv, Value alpha, Value beta, int depth, int ply_from_root) {
+Value Search::alphabeta_search(SearchThread &th, PVLine &pv, Value alpha, Value beta, int depth, int ply_from_root) {
+  Position &pos = *th.pos;
+
   // 千日手(5五将棋ルール)は種類ごとの評価値で返す
   // pos.do_move()しているため、評価値の符号に注意
-  const RepetitionState &repetitionState = pos.is_repetition(16);
+  const RepetitionState &repetitionState = pos.is_repetition();
   if (repetitionState != REPETITION_NONE) {
+    STATS(th.stats.ply[ply_from_root].pruned[SearchStats::PRUNE_REPETITION]++);
     pv.clear();
     return draw_value(repetitionState, pos.side_to_move());
   }
 
   // 探索ノード数をインクリメント
-  Nodes++;
+  th.nodes.increment();
+
+  // これ以上深くはStateInfoや読み筋の領域がないので、評価値を返す。
+  if (ply_from_root >= MAX_PLY) {
+    STATS(th.stats.ply[MAX_PLY].leaf++);
+    pv.clear();
+    return Eval::evaluate(pos);
+  }
+
+  // このnodeの手数の統計
+  STATS(SearchStats::Ply &stats = th.stats.ply[ply_from_root]);
+
+  // 末端nodeでは評価関数を呼び出すので、置換表や詰み判定を調べている間にEvalHashを読み込んでおく。
+  if (depth == 0)
+    Eval::prefetch_eval_hash(pos.key());
 
   // 探索打ち切り
   if (Stop) {
@@ -284,7 +609,7 @@ Value Search::alphabeta_search(Position &pos, std::vector<Move> &pv, Value alpha
 #ifdef USE_TRANSPOSITION_TABLE
   // 置換表を参照
   bool ttHit;
-  TTData ttd(MOVE_NONE, VALUE_ZERO, VALUE_ZERO, DEPTH_ENTRY_OFFSET, BOUND_NONE, false, 0);
+  TTData ttd(MOVE16_NONE, VALUE_ZERO, VALUE_ZERO, DEPTH_ENTRY_OFFSET, BOUND_NONE, false, 0);
   TTWriter ttWriter;
 
   // 置換表を検索
@@ -316,70 +641,151 @@ Value Search::alphabeta_search(Position &pos, std::vector<Move> &pv, Value alpha
 
     if (gen_diff <= 1 && storedDepth >= requiredDepth) {  // 現在または前の世代のみ使用
       if (ttd.bound == BOUND_EXACT) {
-        pv.assign(1, ttMove);
+        STATS(stats.pruned[SearchStats::PRUNE_TT]++);
+        pv.set(ttd.move);
         return ttd.value;
       } else if (ttd.bound == BOUND_LOWER && ttd.value >= beta) {
-        pv.assign(1, ttMove);
+        STATS(stats.pruned[SearchStats::PRUNE_TT]++);
+        pv.set(ttd.move);
         return ttd.value;
       } else if (ttd.bound == BOUND_UPPER && ttd.value <= alpha) {
+        STATS(stats.pruned[SearchStats::PRUNE_TT]++);
         return ttd.value;
       }
     }
     // 深さチェックを少し緩和：深さが足りなくても、1手浅いなら許容
     else if (storedDepth >= depth - 1) {
       if (ttd.bound == BOUND_EXACT) {
-        pv.assign(1, ttMove);
+        STATS(stats.pruned[SearchStats::PRUNE_TT]++);
+        pv.set(ttd.move);
         return ttd.value;
       }
     }
   }
 #endif
 
+  // 手番側が次の1手で千日手の局面に戻せるなら、このnodeの評価値はその千日手の値を下回らない。
+  // alphaをその値まで引き上げて、beta以上ならこれ以上探索しない。
+  // (置換表のエントリは千日手を考慮せずに保存されていることがあるので、置換表を調べたあとに行う)
+  Value cycleValue = -VALUE_INFINITE;
+  const RepetitionState cycleState = pos.has_game_cycle();
+  if (cycleState != REPETITION_NONE) {
+    cycleValue = -draw_value(cycleState, ~pos.side_to_move());
+    if (cycleValue > alpha) {
+      alpha = cycleValue;
+      if (alpha >= beta) {
+        STATS(stats.pruned[SearchStats::PRUNE_CYCLE]++);
+        pv.clear();
+        return alpha;
+      }
+    }
+  }
+
+#ifdef USE_MATE_1PLY
+  // 手番側に短い詰みがあれば、全幅探索をせずに詰みのスコアを返す。
+  if (!pos.in_check()) {
+    Move mateMove = Mate::mate_1ply(pos);
+    if (mateMove != MOVE_NONE) {
+      STATS(stats.pruned[SearchStats::PRUNE_MATE1]++);
+      pv.set(to_move16(mateMove));
+      return mate_in(ply_from_root + 1);
+    }
+
+#ifdef USE_MATE_3PLY
+    // 3手詰めは1手詰めより重いので、残り深さが浅いnodeでは呼び出さない。
+    if (depth >= 2) {
+      mateMove = Mate::mate_3ply(pos);
+      if (mateMove != MOVE_NONE) {
+        STATS(stats.pruned[SearchStats::PRUNE_MATE3]++);
+        pv.set(to_move16(mateMove));
+        return mate_in(ply_from_root + 3);
+      }
+    }
+#endif
+  }
+#endif
+
   // 探索深さに達したら評価関数を呼び出して終了
+  // (千日手にできるなら、評価値がその値を下回らないようにする)
   if (depth == 0) {
+    STATS(stats.leaf++);
     pv.clear();
-    return Eval::evaluate(pos);
+    return std::max(cycleValue, Eval::evaluate(pos));
   }
 
   Value maxValue = -VALUE_INFINITE;
-  std::vector<Move> bestPv;
-  StateInfo si;
-  const auto legalMoves = MoveList<LEGAL_ALL>(pos);
+  StateInfo &si = th.states[ply_from_root];
+  ExtMove moves[MAX_MOVES];
+  ExtMove *const endMoves = generateMoves<LEGAL>(pos, moves);
+  ASSERT_LV3(endMoves <= moves + MAX_MOVES);
 
-  if(legalMoves.size() == 0) {
+  if (endMoves == moves) {
     // 合法手が存在しない -> 詰み
+    STATS(stats.leaf++);
     pv.clear();
     return mated_in(ply_from_root);
   }
-  
+  STATS(stats.interior++);
+
+  // 探索順序の最適化
+  // 置換表の最善手、駒を取る指し手のうち取り合いで損をしない(SEE >= 0)もの、killer、
+  // その他の指し手(historyの高い順)の順に調べる。
+  const Color us = pos.side_to_move();
+  Move16 *const killers = th.killers[ply_from_root];
 #ifdef USE_TRANSPOSITION_TABLE
-  // 探索順序の最適化：置換表の最善手を優先
-  std::deque<ExtMove> orderedMoves;
-  for (const ExtMove &move : legalMoves) {
-    if (ttHit && move.move == ttMove) {
-      // 置換表の最善手を最初に
-      orderedMoves.push_front(move);
-    } else {
-      orderedMoves.emplace_back(move);
-    }
-  }
+  const Move16 ttMove16 = ttHit ? to_move16(ttMove) : MOVE16_NONE;
 #else
-  std::vector<ExtMove> orderedMoves;
-  for (ExtMove move : legalMoves) {
-    orderedMoves.push_back(move);
-  }
+  const Move16 ttMove16 = MOVE16_NONE;
 #endif
+  for (ExtMove *m = moves; m != endMoves; ++m) {
+    const Move16 m16 = to_move16(m->move);
+    if (m16 == ttMove16 && m16 != MOVE16_NONE)
+      m->value = ORDER_TT_MOVE;
+    else if (is_capture(pos, m->move) && pos.see_ge(m->move))
+      m->value = ORDER_GOOD_CAPTURE;
+    else if (m16 == killers[0])
+      m->value = ORDER_KILLER + 1;
+    else if (m16 == killers[1])
+      m->value = ORDER_KILLER;
+    else
+      m->value = th.history[us][from_to(m->move)];
+  }
+  sort_moves(moves, endMoves);
+
+  // betaカットを起こした指し手より先に調べた駒を取らない指し手。historyを減点するのに用いる。
+  Move quietsSearched[MAX_MOVES];
+  int quietCount = 0;
 
   const int alphaOrig = alpha;
-  for (ExtMove &move : orderedMoves) {
-    std::vector<Move> childPv;
+  PVLine &childPv = th.pvs[ply_from_root + 1];
+  pv.clear();
+
+  // ABDADA : このnodeを探索中であることを他のスレッドに知らせる。
+  // 後回しにした指し手はmovesの末尾(end以降)に積んで、他の指し手のあとに調べる。
+  const bool abdada = useAbdada && depth >= ABDADA_MIN_DEPTH;
+  const BreadcrumbGuard breadcrumb(abdada, pos.key(), th.id);
+  const bool deferChildren = abdada && depth - 1 >= ABDADA_MIN_DEPTH;
+  ExtMove *end = endMoves;
+  STATS(int moveCount = 0);
+
+  for (ExtMove *m = moves; m != end; ++m) {
+    const Move move = m->move;
+    const bool quiet = !is_capture(pos, move);
+
+    pos.do_move(move, si); // 局面を1手進める
+
+    if (deferChildren && m != moves && m < endMoves && end < moves + MAX_MOVES &&
+        being_searched(pos.key(), th.id)) {
+      pos.undo_move(move);
+      *end++ = *m;
+      STATS(stats.abdadaDeferred++);
+      continue;
+    }
+    STATS(++moveCount);
 
-    pos.do_move(move.move, si); // 局面を1手進める
-    
-    // [TODO] ExtMoveにはvalueがあるけどそれを使うべきかを検討(そのまま置換するとエラーが出る)
-    Value value = (-1) * alphabeta_search(pos, childPv, -beta, -alpha, depth - 1, ply_from_root + 1); // 再帰的に呼び出し
+    Value value = (-1) * alphabeta_search(th, childPv, -beta, -alpha, depth - 1, ply_from_root + 1); // 再帰的に呼び出し
     
-    pos.undo_move(move.move);
+    pos.undo_move(move);
 
     if(!is_valid_value(value)) {
       // 探索打ち切られ
@@ -389,20 +795,35 @@ Value Search::alphabeta_search(Position &pos, std::vector<Move> &pv, Value alpha
     // アルファ・ベータカット
     if(value >= beta) {
       // betaカットの場合でも最適なPVを返す
-      pv.clear();
-      pv.emplace_back(move.move);
-      pv.insert(pv.end(), childPv.begin(), childPv.end());
-      bestPv = pv;
+      pv.set(to_move16(move), childPv);
       maxValue = value;
+
+      STATS(stats.betaCutoffs++);
+      STATS(stats.firstMoveCutoffs += moveCount == 1);
+      STATS(stats.ttMoveCutoffs += to_move16(move) == ttMove16 && ttMove16 != MOVE16_NONE);
+      STATS(stats.movesBeforeCutoff += moveCount);
+
+      // 駒を取らない指し手でのbetaカットなら、killerとhistoryを更新する。
+      if (quiet) {
+        if (killers[0] != to_move16(move)) {
+          killers[1] = killers[0];
+          killers[0] = to_move16(move);
+        }
+        const int bonus = std::min(depth * depth, HISTORY_MAX);
+        update_history(th, us, move, bonus);
+        for (int i = 0; i < quietCount; ++i)
+          update_history(th, us, quietsSearched[i], -bonus);
+      }
       break;
     }
 
+    if (quiet)
+      quietsSearched[quietCount++] = move;
+
     if(value > maxValue) {
       maxValue = value;
       // 最適なPVを構築
-      bestPv.clear();
-      bestPv.emplace_back(move.move);
-      bestPv.insert(bestPv.end(), childPv.begin(), childPv.end());
+      pv.set(to_move16(move), childPv);
     }
 
     if(value > alpha) {
@@ -424,14 +845,15 @@ Value Search::alphabeta_search(Position &pos, std::vector<Move> &pv, Value alpha
       bound = BOUND_EXACT;
     }
 
-    const Move &bestMove = bestPv.empty() ? MOVE_NONE : bestPv[0];
-    const Value &evalValue = Eval::evaluate(pos);
+    const Move16 bestMove = pv.empty() ? MOVE16_NONE : pv.moves[0];
+    // 内部nodeでは評価関数を呼び出していないので、静的評価値は置換表かEvalHashにあるものを流用する。
+    // (どちらにもなければVALUE_NONE。この値は探索では参照していない)
+    const Value evalValue = ttHit ? ttd.eval : Eval::probe_eval_hash(pos);
 
     ttWriter.write(pos.key(), maxValue, true, bound, depth, bestMove, evalValue, TT.generation());
   }
 #endif
 
-  pv = bestPv;
   if(maxValue == -VALUE_INFINITE) {
     // 探索打ち切られている
     return VALUE_NONE;
@@ -450,169 +872,208 @@ Search::ParallelSearchManager::~ParallelSearchManager() {
 void Search::ParallelSearchManager::initialize(size_t num_threads) {
   task_manager = std::make_unique<SearchTaskManager>();
   task_manager->initialize(num_threads);
-  mate_searcher = std::make_unique<Mate::MateSearcher>();
 }
 
 void Search::ParallelSearchManager::start_parallel_search(Position &rootPos, int max_depth, TimePoint time_limit) {
   // 詰み探索の開始
-  int mate_depth = Mate::Utils::calculate_mate_depth(time_limit, 20);
-  start_mate_search(rootPos, mate_depth);
-}
-
-void Search::ParallelSearchManager::search_root_moves_parallel(Position &pos, int depth, Value alpha, Value beta) {
-  std::cout << "\n=== 並列α探索開始チェック (depth=" << depth << ", root_moves="
-            << Search::rootMoves.size() << ") ===" << std::endl;
-
-  std::cout << "task_manager: " << (task_manager ? "有効" : "null") << std::endl;
-  if (task_manager) {
-    std::cout << "active_threads: " << task_manager->get_active_threads() << std::endl;
-  }
-  std::cout << "rootMoves.empty(): " << (Search::rootMoves.empty() ? "true" : "false") << std::endl;
-
-  if (!task_manager || Search::rootMoves.empty()) {
-    std::cout << "並列探索をスキップします" << std::endl;
-    return;
-  }
-
-  std::cout << "\n=== 並列α探索開始 (depth=" << depth << ", root_moves="
-            << Search::rootMoves.size() << ") ===" << std::endl;
-
-  // 直接スレッドを生成して並列探索（ThreadPoolの問題を回避）
-  size_t num_threads = std::min(task_manager->get_active_threads(), Search::rootMoves.size());
-  std::vector<std::thread> threads;
-  std::cout << "直接スレッド生成: " << num_threads << "個のスレッドを起動" << std::endl;
-
-  for (size_t thread_id = 0; thread_id < num_threads; ++thread_id) {
-    threads.emplace_back([&, thread_id]() {
-      std::cout << "[Thread " << thread_id << "] α探索スレッド開始（直接起動）" << std::endl;
-
-      // 実際の探索処理
-      for (size_t i = thread_id; i < Search::rootMoves.size(); i += num_threads) {
-        if (Search::Stop || Search::Limits.nodes && Search::Nodes >= (uint64_t)Search::Limits.nodes) {
-          break;
-        }
-
-        Move move = Search::rootMoves[i].pv[0];
-        std::cout << "[Thread " << thread_id << "] rootMove[" << i << "] (" << move << ") を探索開始" << std::endl;
-
-        Position thread_pos = pos; // スレッドごとにコピー
-        StateInfo si;
-
-        thread_pos.do_move(move, si);
-        std::vector<Move> pv;
-        Value value = (-1) * alphabeta_search(thread_pos, pv, alpha, beta, depth-1, 0);
-        thread_pos.undo_move(move);
-
-        // 結果の更新（スレッドセーフ）
-        Search::rootMoves[i].score = value;
-        Search::rootMoves[i].selDepth = depth;
-        if (!pv.empty()) {
-          Search::rootMoves[i].pv.clear();
-          Search::rootMoves[i].pv.emplace_back(move);
-          Search::rootMoves[i].pv.insert(Search::rootMoves[i].pv.end(), pv.begin(), pv.end());
-        }
-
-        std::cout << "[Thread " << thread_id << "] rootMove[" << i << "] 終了 value=" << value << std::endl;
-      }
-
-      std::cout << "[Thread " << thread_id << "] α探索スレッド終了" << std::endl;
-    });
-  }
-
-  // 全スレッドの完了を待機
-  for (auto& thread : threads) {
-    if (thread.joinable()) {
-      thread.join();
-    }
-  }
-
-  std::cout << "=== 並列α探索終了 ===\n" << std::endl;
-
-  // 探索結果のデバッグ表示
-  std::cout << "--- 並列探索結果 ---" << std::endl;
-  for (size_t i = 0; i < std::min(Search::rootMoves.size(), (size_t)5); ++i) {
-    std::cout << "rootMoves[" << i << "] move=" << Search::rootMoves[i].pv[0]
-              << " score=" << Search::rootMoves[i].score << std::endl;
-  }
-  std::cout << "--------------------" << std::endl;
-
-  // 簡単な同期処理（ThreadPoolの問題を回避）
-  std::this_thread::sleep_for(std::chrono::milliseconds(100));
-  std::cout << "=== 簡易同期完了 ===" << std::endl;
+  // 探索手数の上限はoptionで指定されていなければ、この指し手に使える時間から決める。
+  const size_t mate_threads = (int)Options["MateThreads"];
+  const int mate_depth = (int)Options["MateDepth"] ? (int)Options["MateDepth"]
+                                                  : Mate::Utils::calculate_mate_depth(time_limit, 1);
+  if (mate_threads > 0)
+    start_mate_search(rootPos, mate_depth, mate_threads);
 }
 
-void Search::ParallelSearchManager::start_mate_search(Position &rootPos, int mate_depth) {
-  std::cout << "\n=== 詰み探索開始チェック (depth=" << mate_depth << ") ===" << std::endl;
-  std::cout << "mate_searcher: " << (mate_searcher ? "有効" : "null") << std::endl;
-  std::cout << "task_manager: " << (task_manager ? "有効" : "null") << std::endl;
-
-  if (!mate_searcher || mate_depth <= 0) {
-    std::cout << "詰み探索をスキップします" << std::endl;
-    return;
-  }
-
-  std::cout << "\n=== 並列詰み探索開始 (depth=" << mate_depth << ") ===" << std::endl;
-
-  mate_search_active = true;
-  mate_searcher->reset();
-
-  // 詰み探索を直接スレッドで実行
-  std::thread mate_thread([&]() {
-    std::cout << "[Mate Thread] 詰み探索スレッド開始" << std::endl;
-    ParallelDebug::g_monitor.mate_search_started(0);
-
-    std::vector<Move> pv;
-    Position mate_pos = rootPos; // コピーして使用
-    Value mate_value = mate_searcher->search_mate(mate_pos, pv, mate_depth, 0);
-
-    bool found_mate = mate_value > VALUE_ZERO;
-    ParallelDebug::g_monitor.mate_search_finished(0, found_mate, mate_depth);
-
-    if (found_mate) {
-      // 詰み発見
-      latest_mate_result.found = true;
-      latest_mate_result.value = mate_value;
-      latest_mate_result.depth = mate_depth;
-      latest_mate_result.nodes_searched = mate_searcher->get_nodes();
-      if (!pv.empty()) {
-        latest_mate_result.best_move = pv[0];
-        latest_mate_result.pv = pv;
+void Search::ParallelSearchManager::search_root_moves_parallel(SearchThread &th, int depth, Value alpha, Value beta) {
+  const size_t n = rootMoves.size();
+
+  // 指し手ごとの探索結果。i番目は、その指し手を取ったスレッドだけが書き込む。
+  // rootMovesへの反映は、全スレッドの探索が終わってからこのスレッドで行う。
+  struct RootResult {
+    Value value = VALUE_NONE;
+    bool exact = false; // 探索窓の中の値(fail lowしていない)か
+    PVLine pv;
+  };
+  std::vector<RootResult> results(n);
+
+  // これまでに探索した指し手の最大値。後から探索する指し手はこれを下限とする窓で探索する。
+  std::atomic<int> sharedAlpha{alpha};
+
+  auto search_move = [&](SearchThread &t, size_t i) {
+    Position &pos = *t.pos;
+    const Move move = pos.reconstruct_move(rootMoves[i].pv[0]);
+    const Value a = Value(sharedAlpha.load(std::memory_order_relaxed));
+    RootResult &r = results[i];
+
+    pos.do_move(move, t.states[0]);
+    const RepetitionState repetitionState = pos.is_repetition();
+    if (repetitionState != REPETITION_NONE) {
+      r.value = -draw_value(repetitionState, pos.side_to_move());
+      r.pv.clear();
+    } else
+      r.value = (-1) * alphabeta_search(t, r.pv, -beta, -a, depth - 1, 1);
+    pos.undo_move(move);
+
+    if (!is_valid_value(r.value))
+      return;
+    r.exact = r.value > a;
+
+    int current = sharedAlpha.load(std::memory_order_relaxed);
+    while (r.value > current && !sharedAlpha.compare_exchange_weak(current, r.value))
+      ;
+  };
+
+  // 最初の指し手(前回の反復での最善手)はこのスレッドで探索して、alphaを決めておく。
+  search_move(th, 0);
+
+  // 残りの指し手は、手の空いたスレッドが次の指し手を取っていく。
+  // run_custom_jobs()は全スレッドの探索が終わるまで戻らない。
+  std::atomic<size_t> next{1};
+  Threading::Pool.run_custom_jobs([&](size_t id) {
+    SearchThread &t = Threads[id];
+    while (!Stop) {
+      const size_t i = next.fetch_add(1, std::memory_order_relaxed);
+      if (i >= n)
+        break;
+      if (Limits.nodes && nodes_searched() >= (uint64_t)Limits.nodes) {
+        Stop = true;
+        break;
       }
-      Search::Stop = true; // 全探索を停止
-      std::cout << "*** 詰み発見! 全探索を停止します ***" << std::endl;
+      search_move(t, i);
     }
-    mate_search_active = false;
-    std::cout << "[Mate Thread] 詰み探索スレッド終了" << std::endl;
   });
 
-  // 詰み探索スレッドをデタッチ（バックグラウンドで実行）
-  mate_thread.detach();
-
-  std::cout << "=== 並列詰み探索終了 ===\n" << std::endl;
-}
-
-bool Search::ParallelSearchManager::check_mate_result() {
-  return mate_search_active == false && latest_mate_result.found;
-}
-
-void Search::ParallelSearchManager::stop_all_searches() {
-  Search::Stop = true;
-
-  if (mate_searcher) {
-    mate_searcher->stop();
-  }
-
-  if (task_manager) {
-    task_manager->stop_all_searches();
+  // 結果をrootMovesに反映する。fail lowした指し手の値は上界なので、最善手とは窓の中の値で比べる。
+  Value bestValue = -VALUE_INFINITE;
+  Move16 best = MOVE16_NONE;
+  for (size_t i = 0; i < n; ++i) {
+    RootMove &rm = rootMoves[i];
+    const RootResult &r = results[i];
+    rm.pv.resize(1);
+    rm.selDepth = depth;
+    if (!is_valid_value(r.value)) {
+      rm.score = -VALUE_INFINITE;
+      continue;
+    }
+    rm.pv.insert(rm.pv.end(), r.pv.begin(), r.pv.end());
+    rm.score = r.value;
+    if (r.exact && r.value > bestValue) {
+      bestValue = r.value;
+      best = rm.pv[0];
+    }
   }
 
-  mate_search_active = false;
+  // 評価値順に並べて、最善手を先頭にする。(fail lowした指し手が最善手と同じ値になっていることがある)
+  std::stable_sort(rootMoves.begin(), rootMoves.end());
+  auto it = std::find_if(rootMoves.begin(), rootMoves.end(),
+                         [&](const RootMove &rm) { return rm.pv[0] == best; });
+  if (it != rootMoves.end())
+    std::rotate(rootMoves.begin(), it, it + 1);
 }
 
+void Search::ParallelSearchManager::start_mate_search(const Position &rootPos, int mate_depth, size_t num_threads) {
+  // 前回の詰み探索スレッドが残っていれば終了させる。
+  stop_mate_threads();
+
+  if (mate_depth <= 0 || num_threads == 0)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(mate_mutex);
+    latest_mate_result = Mate::MateResult();
+  }
+
+  // 各スレッドは自分専用のPositionをsfenから構築して用いる。
+  // (rootPosやそのStateInfoはメインスレッドの探索で書き換わるので共有しない)
+  const std::string sfen = rootPos.sfen();
+
+  mate_searchers.clear();
+  for (size_t thread_id = 0; thread_id < num_threads; ++thread_id) {
+    mate_searchers.emplace_back(std::make_unique<Mate::MateSearcher>());
+    mate_searchers.back()->reset();
+    mate_searchers.back()->set_root_partition(thread_id, num_threads);
+  }
+
+  mate_search_active = (int)num_threads;
+
+  for (size_t thread_id = 0; thread_id < num_threads; ++thread_id) {
+    Mate::MateSearcher *searcher = mate_searchers[thread_id].get();
+
+    mate_threads.emplace_back([this, searcher, sfen, mate_depth]() {
+      StateInfo si;
+      Position mate_pos;
+      mate_pos.set(sfen, &si);
+
+      RepetitionTable repetitions;
+      mate_pos.set_repetition_table(&repetitions);
+
+      // 短い詰みから順に探す(1,3,5,...手詰め)
+      for (int depth = 1; depth <= mate_depth && !searcher->should_stop(); depth += 2) {
+        std::vector<Move> pv;
+        const Value mate_value = searcher->search_mate(mate_pos, pv, depth, 0);
+
+        if (mate_value > VALUE_ZERO && !pv.empty()) {
+          {
+            std::lock_guard<std::mutex> lock(mate_mutex);
+            // 他のスレッドがより短い詰みを見つけていればそちらを優先する。
+            if (!latest_mate_result.found || latest_mate_result.value < mate_value) {
+              latest_mate_result.found = true;
+              latest_mate_result.value = mate_value;
+              latest_mate_result.depth = depth;
+              latest_mate_result.nodes_searched = searcher->get_nodes();
+              latest_mate_result.best_move = pv[0];
+              latest_mate_result.pv = pv;
+            }
+          }
+
+          // 通常探索を打ち切る
+          Search::Stop = true;
+          break;
+        }
+      }
+
+      --mate_search_active;
+    });
+  }
+}
+
+bool Search::ParallelSearchManager::check_mate_result() {
+  std::lock_guard<std::mutex> lock(mate_mutex);
+  if (!latest_mate_result.found)
+    return false;
+
+  merge_mate_results();
+  return true;
+}
+
+void Search::ParallelSearchManager::stop_all_searches() {
+  Search::Stop = true;
+
+  stop_mate_threads();
+
+  if (task_manager) {
+    task_manager->stop_all_searches();
+  }
+}
+
+void Search::ParallelSearchManager::stop_mate_threads() {
+  for (auto &searcher : mate_searchers)
+    searcher->stop();
+
+  for (auto &thread : mate_threads)
+    if (thread.joinable())
+      thread.join();
+
+  mate_threads.clear();
+  mate_search_active = 0;
+}
+
 Search::ParallelSearchManager::SearchStats Search::ParallelSearchManager::get_search_stats() const {
   SearchStats stats;
-  stats.total_nodes = Search::Nodes;
-  stats.mate_nodes = mate_searcher ? mate_searcher->get_nodes() : 0;
+  stats.total_nodes = Search::nodes_searched();
+  stats.mate_nodes = 0;
+  for (const auto &searcher : mate_searchers)
+    stats.mate_nodes += searcher->get_nodes();
   stats.active_threads = task_manager ? task_manager->get_active_threads() : 0;
   stats.mate_found = latest_mate_result.found;
   stats.search_time = TimePoint(0); // 実装する場合は計測を追加
@@ -625,13 +1086,16 @@ void Search::ParallelSearchManager::cleanup_searches() {
   }
 }
 
+// mate_mutexを取得した状態で呼び出すこと。
 void Search::ParallelSearchManager::merge_mate_results() {
   if (latest_mate_result.found && !latest_mate_result.pv.empty()) {
     // 詰み結果をrootMovesに反映
     for (auto& rootMove : Search::rootMoves) {
-      if (rootMove.pv[0] == latest_mate_result.best_move) {
+      if (rootMove == latest_mate_result.best_move) {
         rootMove.score = latest_mate_result.value;
-        rootMove.pv = latest_mate_result.pv;
+        rootMove.pv.clear();
+        for (Move m : latest_mate_result.pv)
+          rootMove.pv.emplace_back(to_move16(m));
         rootMove.selDepth = latest_mate_result.depth;
         break;
       }
@@ -641,12 +1105,10 @@ void Search::ParallelSearchManager::merge_mate_results() {
 
 // SearchTaskManagerの非テンプレート実装
 void Search::SearchTaskManager::initialize(size_t num_threads) {
-  thread_pool = std::make_unique<Threading::ThreadPool>(num_threads);
+  Threading::Pool.set_size(num_threads);
 }
 
+// プールのタスクは実行中に中断できないので、停止フラグを立てるだけ。(各タスクがSearch::Stopを見て終わる)
 void Search::SearchTaskManager::stop_all_searches() {
   search_stopped = true;
-  if (thread_pool) {
-    thread_pool->stop_searching();
-  }
 }
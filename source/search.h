@@ -6,8 +6,11 @@
 #include "tt.h"
 #include "mate.h"
 #include "thread_pool.h"
+#include <cstring>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 
 namespace Search {
@@ -17,9 +20,9 @@ namespace Search {
 // scoreはnon-pvの指し手では-VALUE_INFINITEで初期化される。
 struct RootMove {
   // pv[0]には、コンストラクタの引数で渡されたmを設定する。
-  explicit RootMove(Move m) : pv(1, m) {}
+  explicit RootMove(Move m) : pv(1, to_move16(m)) {}
 
-  bool operator==(const Move &m) const { return pv[0] == m; }
+  bool operator==(const Move &m) const { return pv[0] == to_move16(m); }
 
   bool operator<(const RootMove &m) const {
     return m.score != score ? m.score < score : m.previousScore < previousScore;
@@ -34,17 +37,157 @@ struct RootMove {
   // rootから最大、何手目まで探索したか(選択深さの最大)
   int selDepth = 0;
 
-  // この指し手で進めたときのpv
-  std::vector<Move> pv;
+  // この指し手で進めたときのpv。16bit形式なので、rootで指すときはPosition::reconstruct_move()でMoveに戻す。
+  std::vector<Move16> pv;
 };
 
 typedef std::vector<RootMove> RootMoves;
 
+// 探索中に子ノードから親ノードへ返す読み筋。
+// ノードごとにヒープを確保しないように、固定長の配列に16bit形式の指し手で持つ。
+struct PVLine {
+  Move16 moves[MAX_PLY];
+  int length = 0;
+
+  void clear() { length = 0; }
+  bool empty() const { return length == 0; }
+
+  // mだけの読み筋にする。
+  void set(Move16 m) {
+    moves[0] = m;
+    length = 1;
+  }
+
+  // mに続けてchildの読み筋をつなげたものにする。
+  void set(Move16 m, const PVLine &child) {
+    moves[0] = m;
+    length = std::min(child.length + 1, MAX_PLY);
+    std::copy(child.moves, child.moves + (length - 1), moves + 1);
+  }
+
+  const Move16 *begin() const { return moves; }
+  const Move16 *end() const { return moves + length; }
+};
+
 // 探索開始局面で思考対象とする指し手の集合。
 extern RootMoves rootMoves;
 
-// 今回のgoコマンドでの探索ノード数。
-extern std::atomic<uint64_t> Nodes;
+// --- 探索ノード数
+// 探索スレッドごとに別々のカウンターで数える。共有のカウンターをatomicに加算すると、
+// スレッド間でキャッシュラインの奪い合いになるため。
+
+// 1スレッド分のノード数のカウンター。書き込むのはそのスレッドだけなので、加算はatomicなRMWでなくてよい。
+struct alignas(64) NodeCounter {
+  std::atomic<uint64_t> nodes{0};
+
+  void increment() {
+    nodes.store(nodes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+};
+
+// --- 探索の統計(USE_SEARCH_STATS)
+// 1スレッド分の統計。書き込むのはそのスレッドだけで、読み出すのは探索が終わってから。
+struct SearchStats {
+  // 子nodeを展開せずに値を返した理由
+  enum Prune {
+    PRUNE_REPETITION, // 千日手
+    PRUNE_TT,         // 置換表の値でカット
+    PRUNE_CYCLE,      // 1手で千日手にできるのでalphaを引き上げたらbeta以上
+    PRUNE_MATE1,      // 1手詰め
+    PRUNE_MATE3,      // 3手詰め
+    PRUNE_NB
+  };
+
+  // rootからの手数ごとの値
+  struct Ply {
+    uint64_t interior;          // 指し手を展開したnode
+    uint64_t leaf;              // 評価関数を呼び出したnodeと、合法手がなかったnode
+    uint64_t betaCutoffs;       // betaカットが起きたnode
+    uint64_t firstMoveCutoffs;  // そのうち最初に調べた指し手でカットしたもの
+    uint64_t ttMoveCutoffs;     // そのうち置換表の指し手でカットしたもの
+    uint64_t movesBeforeCutoff; // betaカットまでに調べた指し手の数(カットした指し手を含む)の合計
+    uint64_t abdadaDeferred;    // ABDADAで後回しにした指し手
+    uint64_t pruned[PRUNE_NB];
+  };
+  Ply ply[MAX_PLY + 1];
+
+  void clear() { std::memset(ply, 0, sizeof(ply)); }
+};
+
+// --- 探索スレッドの状態
+// 探索中に参照・更新する、探索スレッドごとの状態をまとめたもの。
+// Threading::Pool.run_custom_jobs()のジョブの番号で引く。0番はメインの探索(反復深化と思考の結果の出力を行う)のもの。
+// ジョブがどのワーカーで実行されるかはプールが決めるので、ワーカーの番号とは一致しない。
+// 探索関数にはこのオブジェクトを参照で渡すので、探索中にスレッドローカル変数や連想配列を引くことはない。
+
+// 指し手の移動元・移動先(from_to())の種類数
+constexpr int FROM_TO_NB = (SQ_NB + 7) * SQ_NB;
+
+struct SearchThread {
+  explicit SearchThread(size_t thread_id) : id(thread_id) {}
+  SearchThread(const SearchThread &) = delete;
+  SearchThread &operator=(const SearchThread &) = delete;
+
+  // rootPosをこのスレッドの探索局面としてコピーし、千日手判定用の索引をこのスレッドのものにする。
+  // rootPosのStateInfo(対局開始からの局面)は、探索が終わるまで破棄してはならない。
+  void set_root(const Position &rootPos);
+
+  // historyを0にする。(isreadyのとき)
+  void clear();
+
+  // ジョブの番号
+  const size_t id;
+
+  // 探索局面。set_root()で設定する。(Positionは代入できないので、コピーを作り直す)
+  std::unique_ptr<Position> pos;
+
+  // 千日手判定用の索引。posが用いる。
+  RepetitionTable repetitions;
+
+  // do_move()に渡すStateInfo。[ply_from_root]を用いる。(rootの局面から1手進めた局面が[0])
+  StateInfo states[MAX_PLY + 1];
+
+  // 子nodeから返される読み筋。[ply_from_root]の探索で求めた読み筋を入れる。
+  PVLine pvs[MAX_PLY + 2];
+
+  // killer move。ply_from_rootごとに、betaカットを起こした駒を取らない指し手を2つまで覚えておく。
+  Move16 killers[MAX_PLY + 1][2];
+
+  // history。手番と、指し手の移動元・移動先(from_to())で引く。
+  int16_t history[COLOR_NB][FROM_TO_NB];
+
+  // このスレッドの探索ノード数
+  NodeCounter nodes;
+
+#if defined(USE_SEARCH_STATS)
+  // このスレッドの探索の統計
+  SearchStats stats;
+#endif
+};
+
+// 探索スレッドの状態の集まり
+class SearchThreads {
+public:
+  // 状態をn個(プールのワーカーの数 + 1)にする。既存のものの内容は保たれる。
+  void set_size(size_t n);
+  size_t size() const { return threads.size(); }
+
+  SearchThread &operator[](size_t i) { return *threads[i]; }
+
+  // 今回のgoコマンドでの探索ノード数。(全スレッドの合計)
+  uint64_t nodes_searched() const;
+
+  // 全スレッドのノード数を0にする。
+  void reset_nodes();
+
+private:
+  std::vector<std::unique_ptr<SearchThread>> threads;
+};
+
+extern SearchThreads Threads;
+
+// 今回のgoコマンドでの探索ノード数。(全スレッドの合計)
+inline uint64_t nodes_searched() { return Threads.nodes_searched(); }
 
 // 探索中にこれがtrueになったら探索を即座に終了すること。
 extern std::atomic<bool> Stop;
@@ -86,6 +229,10 @@ struct LimitsType {
 
 extern LimitsType Limits;
 
+// 直前の探索の統計を"info string"で出力する。("searchstats"コマンド)
+// USE_SEARCH_STATSが定義されていなければ、その旨を出力する。
+void print_stats();
+
 // 探索部の初期化
 void init();
 
@@ -96,17 +243,19 @@ void clear();
 void start_thinking(const Position &rootPos, StateListPtr &states,
                     LimitsType limits);
 
-// 探索本体
-void search(Position &rootPos);
-Value alphabeta_search(Position &pos, std::vector<Move> &pv, Value alpha, Value beta, int depth,
+// 探索本体。th.posについて探索して、bestmoveを出力する。
+void search(SearchThread &th);
+
+// th.posについてのalpha-beta探索。th.pvs[ply_from_root + 1]は子nodeの読み筋に用いるので、pvには渡さないこと。
+Value alphabeta_search(SearchThread &th, PVLine &pv, Value alpha, Value beta, int depth,
                        int ply_from_root);
 
 // 並列探索管理
 class ParallelSearchManager;
 
+// 探索のタスクはプロセスで共有するスレッドプール(Threading::Pool)で実行する。
 class SearchTaskManager {
 private:
-    std::unique_ptr<Threading::ThreadPool> thread_pool;
     std::atomic<bool> search_stopped{false};
 
 public:
@@ -129,21 +278,29 @@ public:
 
     // アクティブなスレッド数を取得
     size_t get_active_threads() const {
-        return thread_pool ? thread_pool->size() : 0;
+        return Threading::Pool.size();
     }
 
     // ThreadPoolへのアクセス
     Threading::ThreadPool* get_thread_pool() const {
-        return thread_pool.get();
+        return &Threading::Pool;
     }
 };
 
 class ParallelSearchManager {
 private:
     std::unique_ptr<SearchTaskManager> task_manager;
-    std::unique_ptr<Mate::MateSearcher> mate_searcher;
-    std::atomic<bool> mate_search_active{false};
+
+    // 詰み探索専用スレッドと、それぞれが用いるMateSearcher
+    std::vector<std::unique_ptr<Mate::MateSearcher>> mate_searchers;
+    std::vector<std::thread> mate_threads;
+
+    // 詰み探索中のスレッドの数
+    std::atomic<int> mate_search_active{0};
+
+    // 詰み探索スレッドが見つけた詰み。mate_mutexで保護する。
     Mate::MateResult latest_mate_result;
+    std::mutex mate_mutex;
 
 public:
     ParallelSearchManager();
@@ -155,16 +312,21 @@ public:
     // 並列探索の開始
     void start_parallel_search(Position &rootPos, int max_depth, TimePoint time_limit);
 
-    // ルートノードの並列探索
-    void search_root_moves_parallel(Position &pos, int depth, Value alpha, Value beta);
+    // ルートノードの並列探索(ParallelModeがRootSplitのとき)
+    // rootMovesの先頭の指し手をthで探索してalphaを決めてから、残りの指し手を全探索スレッドで分け合って探索する。
+    // 各スレッドはその時点での最大値をalphaとする窓で探索する。結果はrootMovesに反映し、最善手を先頭にする。
+    // 探索スレッド(Threads)の1番以降には、rootの局面を設定しておくこと。
+    void search_root_moves_parallel(SearchThread &th, int depth, Value alpha, Value beta);
 
     // 詰み探索の開始
-    void start_mate_search(Position &rootPos, int mate_depth);
+    // rootPosのコピーを詰み探索スレッドごとに作り、num_threads個のスレッドでmate_depth手までの詰みを探す。
+    // 詰みが見つかったらSearch::Stopをtrueにして通常探索を打ち切らせる。
+    void start_mate_search(const Position &rootPos, int mate_depth, size_t num_threads);
 
-    // 詰み探索結果の確認
+    // 詰み探索結果の確認。詰みが見つかっていればrootMovesに反映してtrueを返す。
     bool check_mate_result();
 
-    // 全探索の停止
+    // 全探索の停止。詰み探索スレッドの終了を待つ。
     void stop_all_searches();
 
     // 統計情報の取得
@@ -181,6 +343,9 @@ public:
 private:
     void cleanup_searches();
     void merge_mate_results();
+
+    // 詰み探索スレッドを停止させてjoinする
+    void stop_mate_threads();
 };
 
 // グローバルな並列探索マネージャー
@@ -189,9 +354,9 @@ extern std::unique_ptr<ParallelSearchManager> parallelManager;
 // SearchTaskManagerのテンプレート実装
 template<class F>
 void Search::SearchTaskManager::run_search_task(const std::string& task_type, F&& f) {
-  if (!thread_pool || search_stopped) return;
+  if (search_stopped) return;
 
-  thread_pool->run_custom_jobs([&](size_t thread_id) {
+  Threading::Pool.run_custom_jobs([&](size_t thread_id) {
     if (search_stopped) return;
     f(thread_id);
   });
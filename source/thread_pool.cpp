@@ -1,137 +1,361 @@
 #include "thread_pool.h"
-#include <chrono>
-#include <iostream>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace Threading {
 
-// Threadクラスの実装
-Thread::Thread(size_t id) : thread_id(id) {
-    native_thread = std::thread(&Thread::idle_loop, this);
+ThreadPool Pool;
+
+namespace {
+
+// 呼び出したスレッドが参加しているプールと、そこで用いるdequeの番号
+thread_local const ThreadPool *CurrentPool = nullptr;
+thread_local int CurrentIndex = -1;
+
+using Clock = std::chrono::steady_clock;
+
+// タスクが見つからないとき、眠る(sync()ならyieldする)までにタスクを探し続ける時間。
+// 探索中の短い並列処理の隙間を埋めるためのもので、goコマンドの間隔はこれでは埋まらない。(ThreadPool::prewake()を参照)
+constexpr auto SPIN_TIME = std::chrono::microseconds(100);
+
+// steady_clockの現在時刻[ns]
+inline int64_t clock_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
 }
 
-Thread::~Thread() {
-    terminate();
-    if (native_thread.joinable()) {
-        native_thread.join();
-    }
+// spin中にCPUの実行資源を同じコアの他のスレッドに譲る。
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
 }
 
-void Thread::start() {
-    // スレッドはコンストラクタで自動的に開始される
+// 呼び出したスレッドを、プロセスが使えるindex番目(を論理コア数で割った余り)の論理コアに固定する。
+// Linux以外では何もしない。
+void bind_this_thread(size_t index) {
+#if defined(__linux__)
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return;
+
+    const int count = CPU_COUNT(&allowed);
+    if (count <= 1)
+        return;
+
+    int n = int(index % count);
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed) || n-- > 0)
+            continue;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        return;
+    }
+#else
+    (void)index;
+#endif
 }
 
-void Thread::run_custom_job(std::function<void()> f) {
-    std::unique_lock<std::mutex> lk(mutex);
-    cv.wait(lk, [&]{ return !searching; });
+} // namespace
+
+// TaskDequeクラスの実装
+// "Correct and Efficient Work-Stealing for Weak Memory Models"(Lê et al., 2013)のC11版に従う。
+
+bool TaskDeque::push(Task *task) {
+    const int64_t b = bottom.load(std::memory_order_relaxed);
+    const int64_t t = top.load(std::memory_order_acquire);
+    if (b - t >= CAPACITY)
+        return false;
 
-    jobFunc = std::move(f);
-    searching = true;
-    cv.notify_one();
+    // 論文ではrelease fence + relaxed storeだが、x86では同じコードになり、ThreadSanitizerでも検査できるのでrelease storeにしておく。
+    buffer[b & (CAPACITY - 1)].store(task, std::memory_order_relaxed);
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
 }
 
-void Thread::terminate() {
-    {
-        std::unique_lock<std::mutex> lk(mutex);
-        exit = true;
-        searching = true;
+Task *TaskDeque::pop() {
+    const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+
+    if (t > b) {
+        // 空だった
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Task *task = buffer[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+    if (t == b) {
+        // 最後の1つはstealする側と取り合いになる。
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed))
+            task = nullptr;
+        bottom.store(b + 1, std::memory_order_relaxed);
     }
-    cv.notify_one();
+    return task;
+}
+
+Task *TaskDeque::steal() {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b)
+        return nullptr;
+
+    Task *task = buffer[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+    // 他のスレッドに先に取られたら諦める。(呼び出し側は他のdequeを調べに行く)
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed))
+        return nullptr;
+    return task;
+}
+
+// Threadクラスの実装
+Thread::Thread(ThreadPool &pool_, size_t id) : pool(pool_), thread_id(id) {
+    native_thread = std::thread(&Thread::idle_loop, this);
+}
+
+Thread::~Thread() {
+    // ThreadPool::destroy_threads()でexitが設定されている。
+    if (native_thread.joinable())
+        native_thread.join();
 }
 
 void Thread::idle_loop() {
+    CurrentPool = &pool;
+    CurrentIndex = int(thread_id);
+
+    // ワーカーの番号は1からなので、起点(bind_base)番目の論理コアにはワーカーを固定しない。
+    // goコマンドを処理するスレッド(メインの探索を行う)は固定しないので、ワーカーの数が論理コア数より少なければ
+    // そこが空いているが、OSがそこで動かすとは限らない。
+    if (pool.bind_threads)
+        bind_this_thread(pool.bind_base + thread_id);
+
+    // タスクが見つからなくなった時刻。0ならタスクを実行した直後。
+    int64_t idle_since = 0;
     while (true) {
-        std::unique_lock<std::mutex> lk(mutex);
-        searching = false;
-        cv.notify_one(); // 起動を待っているスレッドを起こす
+        if (Task *task = pool.find_task(CurrentIndex)) {
+            ThreadPool::run_task(task);
+            idle_since = 0;
+            continue;
+        }
 
-        cv.wait(lk, [&]()->bool { return searching.load(); });
+        // しばらくはspinしながらタスクを待つ。
+        // prewake()の期限までは、他のスレッドの邪魔をしないようにyieldしながら待つ。
+        const int64_t t = clock_ns();
+        if (idle_since == 0)
+            idle_since = t;
+        if (t - idle_since < std::chrono::nanoseconds(SPIN_TIME).count()) {
+            cpu_relax();
+            continue;
+        }
+        if (t < pool.spin_deadline.load(std::memory_order_relaxed)) {
+            std::this_thread::yield();
+            continue;
+        }
+        idle_since = 0;
+
+        // 仕事がないので眠る。
+        // sleepersを増やしてからもう一度探すことで、その間にspawn()されたタスクを見逃さない。
+        // (spawn()する側はdequeに積んでからsleepersを見る)
+        uint64_t epoch;
+        {
+            std::lock_guard<std::mutex> lk(pool.sleep_mutex);
+            if (pool.exit)
+                break;
+            epoch = pool.wake_epoch;
+        }
 
-        if (exit) {
-            break;
+        pool.sleepers.fetch_add(1);
+        if (Task *task = pool.find_task(CurrentIndex)) {
+            pool.sleepers.fetch_sub(1);
+            ThreadPool::run_task(task);
+            continue;
         }
 
-        // ジョブがあれば実行
-        if (jobFunc) {
-            jobFunc();
-            jobFunc = nullptr;
+        {
+            std::unique_lock<std::mutex> lk(pool.sleep_mutex);
+            pool.sleep_cv.wait(lk, [&] { return pool.exit || pool.wake_epoch != epoch; });
         }
+        pool.sleepers.fetch_sub(1);
     }
+
+    CurrentPool = nullptr;
+    CurrentIndex = -1;
 }
 
 // ThreadPoolクラスの実装
 ThreadPool::ThreadPool(size_t num_threads) {
-    if (num_threads > 0) {
-        create_threads(num_threads);
-    }
+    create_threads(num_threads);
 }
 
 ThreadPool::~ThreadPool() {
     destroy_threads();
 }
 
+void ThreadPool::set_affinity(bool bind, size_t base_cpu) {
+    if (bind == bind_threads && (!bind || base_cpu == bind_base))
+        return;
+
+    // ワーカーは起動時に自分を固定するので、起動し直す。
+    const size_t num_threads = size();
+    destroy_threads();
+    bind_threads = bind;
+    bind_base = base_cpu;
+    create_threads(num_threads);
+}
+
 void ThreadPool::set_size(size_t num_threads) {
-    if (num_threads == size()) {
+    if (num_threads == size() && deques) {
         return; // 変更不要
     }
 
     destroy_threads();
-    if (num_threads > 0) {
-        create_threads(num_threads);
+    create_threads(num_threads);
+}
+
+int ThreadPool::worker_index() const {
+    return CurrentPool == this ? CurrentIndex : -1;
+}
+
+ThreadPool::ExternalScope::ExternalScope(ThreadPool &pool_) : pool(pool_) {
+    if (pool.worker_index() >= 0)
+        return;
+
+    pool.external_mutex.lock();
+    CurrentPool = &pool;
+    CurrentIndex = 0;
+    entered = true;
+}
+
+ThreadPool::ExternalScope::~ExternalScope() {
+    if (!entered)
+        return;
+
+    CurrentPool = nullptr;
+    CurrentIndex = -1;
+    pool.external_mutex.unlock();
+}
+
+void ThreadPool::prewake(std::chrono::milliseconds window) {
+    if (threads.empty())
+        return;
+
+    // 期限を延ばしてから起こす。起きたワーカーは期限までは眠らない。
+    // 眠ろうとしているワーカーを取りこぼさないように、sleepersによらずwake_epochを進めておく。(コマンドごとに1回なので軽い)
+    spin_deadline.store(clock_ns() + std::chrono::nanoseconds(window).count(), std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lk(sleep_mutex);
+        ++wake_epoch;
     }
+    sleep_cv.notify_all();
 }
 
-// テンプレート関数の明示的実装化は不要（ヘッダで実装）
+void ThreadPool::spawn(TaskGroup &group, Task &task) {
+    task.group = &group;
+    group.pending.fetch_add(1, std::memory_order_relaxed);
 
-void ThreadPool::wait_for_search_finished() {
-    if (!search_running) {
+    // プールに参加していないスレッドからの呼び出しか、dequeが満杯ならその場で実行する。
+    const int self = worker_index();
+    if (self < 0 || !deques[self].push(&task)) {
+        run_task(&task);
         return;
     }
 
-    std::unique_lock<std::mutex> lock(threads_mutex);
-    search_finished_cv.wait(lock, [&]{ return !search_running; });
+    wake_up_worker();
+}
+
+void ThreadPool::sync(TaskGroup &group) {
+    const int self = worker_index();
+    int64_t idle_since = 0;
+    while (group.pending.load(std::memory_order_acquire) > 0) {
+        Task *task = self >= 0 ? find_task(self) : nullptr;
+        if (task != nullptr) {
+            run_task(task);
+            idle_since = 0;
+            continue;
+        }
+
+        const int64_t t = clock_ns();
+        if (idle_since == 0)
+            idle_since = t;
+        if (t - idle_since < std::chrono::nanoseconds(SPIN_TIME).count())
+            cpu_relax();
+        else
+            std::this_thread::yield();
+    }
 }
 
-void ThreadPool::stop_searching() {
-    search_running = false;
+Task *ThreadPool::find_task(int self) {
+    if (Task *task = deques[self].pop())
+        return task;
 
-    // 全スレッドに停止通知
-    for (auto& thread : threads) {
-        thread->run_custom_job([]{}); // 空のジョブで割り込み
+    // 自分の次の番号のワーカーから順に盗みに行く。
+    const int n = deque_count;
+    for (int i = 1; i < n; ++i) {
+        const int victim = (self + i) % n;
+        if (Task *task = deques[victim].steal())
+            return task;
     }
+    return nullptr;
+}
+
+void ThreadPool::run_task(Task *task) {
+    // execute()のあとpendingを減らした時点でtaskは破棄されうるので、先にgroupを読んでおく。
+    TaskGroup *group = task->group;
+    task->execute(task);
+    group->pending.fetch_sub(1, std::memory_order_release);
 }
 
-// テンプレート関数の明示的実装化は不要（ヘッダで実装）
+void ThreadPool::wake_up_worker() {
+    // dequeへの追加とsleepersの読み出しの順序を保証する。(Thread::idle_loop()を参照)
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_relaxed) == 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lk(sleep_mutex);
+        ++wake_epoch;
+    }
+    sleep_cv.notify_one();
+}
 
 void ThreadPool::create_threads(size_t num_threads) {
-    threads.reserve(num_threads);
+    deques = std::make_unique<TaskDeque[]>(num_threads + 1);
+    deque_count = int(num_threads + 1);
 
+    threads.reserve(num_threads);
     for (size_t i = 0; i < num_threads; ++i) {
-        threads.emplace_back(std::make_unique<Thread>(i));
+        threads.emplace_back(std::make_unique<Thread>(*this, i + 1));
     }
-
-    // 全スレッドの起動完了を待機
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
 }
 
 void ThreadPool::destroy_threads() {
-    if (!threads.empty()) {
-        stop_searching();
-
-        // 全スレッドを終了
-        for (auto& thread : threads) {
-            thread->terminate();
-        }
+    // prewake()の期限までyieldしながら待っているワーカーが、すぐに眠る処理に進んでexitに気づくようにする。
+    spin_deadline.store(0, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lk(sleep_mutex);
+        exit = true;
+    }
+    sleep_cv.notify_all();
 
-        // スレッドの終了を待機
-        for (auto& thread : threads) {
-            std::thread* native = &thread->native_thread;
-            if (native->joinable()) {
-                native->join();
-            }
-        }
+    // Threadのデストラクタでjoinする。
+    threads.clear();
 
-        threads.clear();
-    }
+    std::lock_guard<std::mutex> lk(sleep_mutex);
+    exit = false;
 }
 
 // SearchSyncクラスの実装
@@ -162,4 +386,4 @@ void SearchSync::reset(int num_threads) {
     search_ended = false;
 }
 
-} // namespace Threading
\ No newline at end of file
+} // namespace Threading
@@ -1,92 +1,206 @@
 #ifndef _THREAD_POOL_H_
 #define _THREAD_POOL_H_
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
-#include <functional>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <mutex>
 #include <thread>
-#include <unordered_map>
+#include <tuple>
 #include <vector>
 
 namespace Threading {
 
-// やねurao王風のスレッド管理クラス
-class Thread {
-private:
-    std::mutex mutex;
-    std::condition_variable cv;
-    std::function<void()> jobFunc;
-    std::atomic<bool> searching{false};
-    std::atomic<bool> exit{false};
-    std::thread native_thread;
+// --- ワークスティーリングのスレッドプール
+//
+// 各ワーカーは自分用のタスクのdeque(Chase-Lev deque)を持ち、spawn()したタスクを自分のdequeの末尾に積んで、
+// 末尾から取り出して実行する。自分のdequeが空になったら、他のワーカーのdequeの先頭からタスクを盗む。
+// 分割統治で積んだタスクは先頭ほど大きいので、盗まれるのは大きなタスクになり、盗みの回数が少なくて済む。
+//
+// タスクは呼び出し側のスタック上に置くオブジェクトで、プールはヒープを確保しない。
+// spawn()したタスクは、同じTaskGroupをsync()するまで破棄してはならない。
+// sync()は、TaskGroupのタスクが終わるのを待つ間も他のタスクを実行する。(スレッドを遊ばせない)
+//
+// 仕事がなくなったワーカーは、しばらく(SPIN_TIME)pause命令を挟みながらタスクを探し続け(spin)、それでも見つからなければ
+// 条件変数で眠る(park)。短い並列処理が続くときに、そのたびに眠ったスレッドを起こす時間がかからないようにするため。
+// goコマンドの間隔(数百ms)はspinでは埋められないので、USIのposition・goコマンドを受け取った時点でprewake()を呼び出し、
+// 眠っているワーカーを先に起こして、探索のタスクが積まれるまでyieldしながら待たせておく。
+//
+// プール外のスレッド(USIのコマンドを処理するスレッドなど)からparallel_for()などを呼び出すと、
+// そのスレッドもワーカーの1つ(0番のdeque)として処理に加わる。プール外から同時に使えるのは1スレッドだけで、
+// 2つ目のスレッドは先の処理が終わるまで待たされる。
+
+class ThreadPool;
+struct TaskGroup;
+
+// タスク。executeに処理を書いた関数を設定して、spawn()に渡す。
+struct Task {
+    void (*execute)(Task *task) = nullptr;
+
+    // spawn()で設定される。タスクが終わったときにpendingを減らす。
+    TaskGroup *group = nullptr;
+};
 
-public:
-    // ThreadPoolがnative_threadにアクセスするためのfriend宣言
-    friend class ThreadPool;
+// sync()で待ち合わせるタスクの集まり
+struct TaskGroup {
+    // spawn()したが、まだ終わっていないタスクの数
+    std::atomic<int> pending{0};
+};
 
+// Chase-Lev deque。末尾への追加(push)と取り出し(pop)は持ち主のワーカーだけが行い、
+// 先頭からの取り出し(steal)は他のスレッドが行う。容量は固定で、満杯のときpush()はfalseを返す。
+class TaskDeque {
 public:
-    explicit Thread(size_t thread_id);
-    ~Thread();
+    static constexpr int64_t CAPACITY = 1024;
 
-    // スレッドの起動
-    void start();
+    bool push(Task *task);
+    Task *pop();
+    Task *steal();
 
-    // カスタムジョブの実行
-    void run_custom_job(std::function<void()> f);
+    // おおよその要素数。(他のスレッドが操作中なら不正確)
+    bool empty() const {
+        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+    }
+
+private:
+    // stealする側とpush/popする側とでcache lineを分けておく。
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    alignas(64) std::atomic<Task *> buffer[CAPACITY];
+};
 
-    // 探索中かどうかのチェック
-    bool is_searching() const { return searching; }
+// プールのワーカースレッド
+class Thread {
+public:
+    Thread(ThreadPool &pool, size_t thread_id);
+    ~Thread();
 
-    // スレッドの停止
-    void terminate();
+    // ワーカーの番号(1から)。0番はプール外から参加したスレッドが用いる。
+    size_t id() const { return thread_id; }
 
 private:
     void idle_loop();
+
+    ThreadPool &pool;
     size_t thread_id;
+    std::thread native_thread;
 };
 
-// スレッドプール（やねurao王風の設計）
+// スレッドプール
 class ThreadPool {
-private:
-    std::vector<std::unique_ptr<Thread>> threads;
-    std::atomic<bool> search_running{false};
-    std::atomic<size_t> active_threads{0};
-
-    // スレッド同期用
-    std::mutex threads_mutex;
-    std::condition_variable search_finished_cv;
-
 public:
     explicit ThreadPool(size_t num_threads = 0);
     ~ThreadPool();
 
-    // スレッド数の設定
+    // ワーカースレッドの数を設定する。処理中に呼び出してはならない。
     void set_size(size_t num_threads);
 
-    // 現在のスレッド数を取得
+    // ワーカースレッドの数(プール外から参加するスレッドを含まない)
     size_t size() const { return threads.size(); }
 
-    // 全スレッドで探索を開始
-    template<class Func>
-    void start_searching(Func search_func);
+    // ワーカーを論理コアに固定するか(USIオプションのThreadAffinity)と、固定する論理コアの起点(ThreadAffinityBase)。
+    // i番のワーカーは、プロセスが使える論理コアのうち(base_cpu + i)番目(を論理コア数で割った余り)に固定する。
+    // 変更したときはワーカーを起動し直す。処理中に呼び出してはならない。
+    void set_affinity(bool bind, size_t base_cpu);
+
+    // 眠っているワーカーをすべて起こし、いまからwindowの間は眠らずに(yieldしながら)タスクを待たせる。
+    // まもなく並列処理を始めることが分かっているとき(USIのposition・goコマンドを受け取ったとき)に呼び出す。
+    void prewake(std::chrono::milliseconds window);
+
+    // taskを実行するように登録する。taskはgroupをsync()するまで破棄してはならない。
+    // dequeが満杯ならその場で実行する。
+    void spawn(TaskGroup &group, Task &task);
+
+    // groupのタスクがすべて終わるまで待つ。待つ間は他のタスクを実行する。
+    void sync(TaskGroup &group);
+
+    // [begin, end)の各iについてf(i)を並列に呼び出して、すべて終わるまで待つ。
+    // 範囲を2分割していって、grain個以下になったらそのタスクで順番に処理する。
+    template <class F>
+    void parallel_for(size_t begin, size_t end, const F &f, size_t grain = 1);
+
+    // [begin, end)の各iについてmap(i)を求め、reduce(a, b)で畳み込んだ値を返す。
+    // reduceは結合則を満たすこと。(畳み込む順番は決まっていない)
+    template <class T, class Map, class Reduce>
+    T parallel_reduce(size_t begin, size_t end, T identity, const Map &map,
+                      const Reduce &reduce, size_t grain = 1);
+
+    // f(i)をワーカーの数(プール外から参加するスレッドを含む)だけ並列に呼び出して、すべて終わるまで待つ。
+    // iは0からの通し番号で、どのスレッドで実行されるかとは関係ない。
+    template <class Func>
+    void run_custom_jobs(const Func &job_func) {
+        parallel_for(0, size() + 1, job_func);
+    }
+
+private:
+    friend class Thread;
 
-    // 全スレッドの探索完了を待機
-    void wait_for_search_finished();
+    // 呼び出したスレッドが用いるdequeの番号。プール外のスレッドなら-1。
+    int worker_index() const;
 
-    // 全探索の停止
-    void stop_searching();
+    // プール外のスレッドを0番のワーカーとして処理に加える。(parallel_for()などの間)
+    class ExternalScope {
+    public:
+        explicit ExternalScope(ThreadPool &pool);
+        ~ExternalScope();
 
-    // 全スレッドでカスタムジョブを実行
-    template<class Func>
-    void run_custom_jobs(Func job_func);
+    private:
+        ThreadPool &pool;
+        bool entered = false;
+    };
+
+    // 自分のdequeか、他のワーカーのdequeから実行するタスクを探す。なければnullptr。
+    Task *find_task(int self);
+
+    // taskを実行してTaskGroupのpendingを減らす。
+    static void run_task(Task *task);
+
+    // 眠っているワーカーがいれば起こす。
+    void wake_up_worker();
+
+    template <class F>
+    void for_range(size_t begin, size_t end, const F &f, size_t grain);
+
+    template <class T, class Map, class Reduce>
+    T reduce_range(size_t begin, size_t end, const T &identity, const Map &map,
+                   const Reduce &reduce, size_t grain);
 
-private:
     void create_threads(size_t num_threads);
     void destroy_threads();
+
+    // ワーカーを論理コアに固定するか、固定する論理コアの起点
+    bool bind_threads = false;
+    size_t bind_base = 0;
+
+    std::vector<std::unique_ptr<Thread>> threads;
+
+    // [0] : プール外から参加するスレッド用, [1..size()] : ワーカー用
+    // ワーカーが起動してから読むので、dequeの数はthreads.size()とは別に持っておく。
+    std::unique_ptr<TaskDeque[]> deques;
+    int deque_count = 0;
+
+    // プール外から参加するスレッドを1つに制限する。
+    std::mutex external_mutex;
+
+    // 仕事がないワーカーを眠らせておくためのもの
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+    std::atomic<int> sleepers{0};
+    uint64_t wake_epoch = 0; // sleep_mutexで保護する
+    bool exit = false;       // sleep_mutexで保護する
+
+    // prewake()で設定する、ワーカーが眠らずに待つ期限(steady_clockのtime_since_epochをnsで表したもの)
+    std::atomic<int64_t> spin_deadline{0};
 };
 
+// プロセスで共有するスレッドプール。探索、perft、置換表のクリア、評価関数の調整などで用いる。
+// ワーカーの数はSearch::clear()(isready)で設定される。設定されるまでは呼び出したスレッドだけで処理する。
+extern ThreadPool Pool;
+
 // スレッドセーフなカウンタ（やねurao王風）
 template<typename T>
 class ThreadSafeCounter {
@@ -151,40 +265,8 @@ public:
     void reset(int num_threads);
 };
 
-// スレッドローカルストレージ（やねurao王風）
-template<typename T>
-class ThreadLocal {
-private:
-    static thread_local std::unordered_map<std::string, T> storage;
-
-public:
-    // 値の取得
-    static T& get(const std::string& key) {
-        return storage[key];
-    }
-
-    // 値の設定
-    static void set(const std::string& key, const T& value) {
-        storage[key] = value;
-    }
-
-    // 値が存在するかチェック
-    static bool has(const std::string& key) {
-        return storage.find(key) != storage.end();
-    }
-
-    // 値の削除
-    static void erase(const std::string& key) {
-        storage.erase(key);
-    }
-
-    // 全クリア
-    static void clear() {
-        storage.clear();
-    }
-};
-
-// タスクディスパッチャ（やねurao王風）
+// タスクディスパッチャ
+// タスクの割り当ては固定せず、スレッドプールのワークスティーリングに任せる。
 class TaskDispatcher {
 private:
     ThreadPool& thread_pool;
@@ -193,7 +275,7 @@ private:
 public:
     explicit TaskDispatcher(ThreadPool& pool) : thread_pool(pool) {}
 
-    // 並列タスクの実行
+    // 並列タスクの実行。すべてのタスクが終わってから、タスクの順番にresult_handlerを呼び出す。
     template<class TaskFunc, class ResultFunc>
     void dispatch_parallel_tasks(const std::vector<TaskFunc>& tasks, ResultFunc result_handler);
 
@@ -210,34 +292,101 @@ public:
 } // namespace Threading
 
 // テンプレート関数の実装
-template<class Func>
-void Threading::ThreadPool::start_searching(Func search_func) {
-    search_running = true;
-    active_threads = threads.size();
 
-    // 全スレッドで探索関数を実行
-    run_custom_jobs(search_func);
+template <class F>
+void Threading::ThreadPool::parallel_for(size_t begin, size_t end, const F &f, size_t grain) {
+    if (begin >= end)
+        return;
+    ExternalScope scope(*this);
+    for_range(begin, end, f, std::max<size_t>(grain, 1));
 }
 
-template<class Func>
-void Threading::ThreadPool::run_custom_jobs(Func job_func) {
-    if (threads.empty()) return;
+template <class T, class Map, class Reduce>
+T Threading::ThreadPool::parallel_reduce(size_t begin, size_t end, T identity, const Map &map,
+                                         const Reduce &reduce, size_t grain) {
+    if (begin >= end)
+        return identity;
+    ExternalScope scope(*this);
+    return reduce_range(begin, end, identity, map, reduce, std::max<size_t>(grain, 1));
+}
 
-    search_running = true;
-    active_threads = threads.size();
+template <class F>
+void Threading::ThreadPool::for_range(size_t begin, size_t end, const F &f, size_t grain) {
+    // 後半を別のタスクにして、前半はこのスレッドで処理する。
+    struct ForTask : Task {
+        ThreadPool *pool;
+        size_t begin, end, grain;
+        const F *f;
+
+        static void run(Task *task) {
+            auto *t = static_cast<ForTask *>(task);
+            t->pool->for_range(t->begin, t->end, *t->f, t->grain);
+        }
+    };
 
-    for (size_t i = 0; i < threads.size(); ++i) {
-        threads[i]->run_custom_job([&, i]() {
-            job_func(i);
+    if (end - begin <= grain) {
+        for (size_t i = begin; i < end; ++i)
+            f(i);
+        return;
+    }
 
-            // 探索完了通知
-            if (--active_threads == 0) {
-                std::unique_lock<std::mutex> lock(threads_mutex);
-                search_running = false;
-                search_finished_cv.notify_all();
-            }
-        });
+    const size_t mid = begin + (end - begin) / 2;
+    ForTask right;
+    right.execute = &ForTask::run;
+    right.pool = this;
+    right.begin = mid;
+    right.end = end;
+    right.grain = grain;
+    right.f = &f;
+
+    TaskGroup group;
+    spawn(group, right);
+    for_range(begin, mid, f, grain);
+    sync(group);
+}
+
+template <class T, class Map, class Reduce>
+T Threading::ThreadPool::reduce_range(size_t begin, size_t end, const T &identity, const Map &map,
+                                      const Reduce &reduce, size_t grain) {
+    struct ReduceTask : Task {
+        ThreadPool *pool;
+        size_t begin, end, grain;
+        const T *identity;
+        const Map *map;
+        const Reduce *reduce;
+        T result;
+
+        static void run(Task *task) {
+            auto *t = static_cast<ReduceTask *>(task);
+            t->result = t->pool->reduce_range(t->begin, t->end, *t->identity, *t->map, *t->reduce,
+                                              t->grain);
+        }
+    };
+
+    if (end - begin <= grain) {
+        T acc = identity;
+        for (size_t i = begin; i < end; ++i)
+            acc = reduce(acc, map(i));
+        return acc;
     }
+
+    const size_t mid = begin + (end - begin) / 2;
+    ReduceTask right;
+    right.execute = &ReduceTask::run;
+    right.pool = this;
+    right.begin = mid;
+    right.end = end;
+    right.grain = grain;
+    right.identity = &identity;
+    right.map = &map;
+    right.reduce = &reduce;
+    right.result = identity;
+
+    TaskGroup group;
+    spawn(group, right);
+    T left = reduce_range(begin, mid, identity, map, reduce, grain);
+    sync(group);
+    return reduce(left, right.result);
 }
 
 template<class TaskFunc, class ResultFunc>
@@ -247,18 +396,17 @@ void Threading::TaskDispatcher::dispatch_parallel_tasks(
 
     if (tasks.empty()) return;
 
+    // 停止したときに実行されなかったタスクはindexをtasks.size()のままにしておき、result_handlerを呼ばない。
     std::vector<std::tuple<decltype(tasks[0]()), size_t>> results(tasks.size());
+    for (auto& result : results)
+        std::get<1>(result) = tasks.size();
 
-    thread_pool.run_custom_jobs([&](size_t thread_id) {
-        for (size_t i = thread_id; i < tasks.size(); i += thread_pool.size()) {
-            if (is_stopped()) break;
+    thread_pool.parallel_for(0, tasks.size(), [&](size_t i) {
+        if (is_stopped()) return;
 
-            results[i] = std::make_tuple(tasks[i](), i);
-        }
+        results[i] = std::make_tuple(tasks[i](), i);
     });
 
-    thread_pool.wait_for_search_finished();
-
     // 結果の処理
     for (auto& result : results) {
         if (std::get<1>(result) < tasks.size()) {
@@ -267,8 +415,4 @@ void Threading::TaskDispatcher::dispatch_parallel_tasks(
     }
 }
 
-// スレッドローカルストレージの実装
-template<typename T>
-thread_local std::unordered_map<std::string, T> Threading::ThreadLocal<T>::storage;
-
-#endif // !_THREAD_POOL_H_
\ No newline at end of file
+#endif // !_THREAD_POOL_H_
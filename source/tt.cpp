@@ -1,13 +1,14 @@
 #include "tt.h"
 #include "misc.h"
+#include "thread_pool.h"
 
 // グローバル置換表
 TranspositionTable TT;
 
 // ■ TTEntryのメソッド実装（ヘッダーファイルに移動したもの以外）
 
-Move TTEntry::move() const {
-    return move_from16(move16);
+Move16 TTEntry::move() const {
+    return move16;
 }
 
 Value TTEntry::value() const {
@@ -43,6 +44,23 @@ TranspositionTable::~TranspositionTable() {
     }
 }
 
+// ■ clear()メソッドの解説
+//
+// 数百MBのmemsetは1スレッドだと時間がかかるので、テーブルを区間に分けてスレッドプールで並列にクリアする。
+// 1区間は2MB程度にして、ワーカーの数より十分多く分けておく。(速いスレッドが残りを盗んでいく)
+void TranspositionTable::clear() {
+    if (!table)
+        return;
+
+    const size_t chunkClusters = std::max<size_t>(1, (2 * 1024 * 1024) / sizeof(Cluster));
+    const size_t chunks = (clusterCount + chunkClusters - 1) / chunkClusters;
+    Threading::Pool.parallel_for(0, chunks, [&](size_t i) {
+        const size_t begin = i * chunkClusters;
+        const size_t end = std::min(begin + chunkClusters, clusterCount);
+        std::memset(&table[begin], 0, sizeof(Cluster) * (end - begin));
+    });
+}
+
 // ■ probe()メソッドの解説
 //
 // 置換表から指定された局面を検索する最も重要な関数。
@@ -62,7 +80,7 @@ TranspositionTable::~TranspositionTable() {
 std::tuple<bool, TTData, TTWriter> TranspositionTable::probe(const Key key) const {
     // テーブルが未確保の場合は未ヒットで返す
     if (!table) {
-        return std::make_tuple(false, TTData(MOVE_NONE, VALUE_ZERO, VALUE_ZERO, DEPTH_ENTRY_OFFSET, BOUND_NONE, false, 0), TTWriter(nullptr));
+        return std::make_tuple(false, TTData(MOVE16_NONE, VALUE_ZERO, VALUE_ZERO, DEPTH_ENTRY_OFFSET, BOUND_NONE, false, 0), TTWriter(nullptr));
     }
 
     // ハッシュキーの上位32bitで比較対象とする
@@ -103,5 +121,5 @@ std::tuple<bool, TTData, TTWriter> TranspositionTable::probe(const Key key) cons
     }
 
     // 未ヒット：ダミーデータと選択したエントリの書き込み権を返す
-    return std::make_tuple(false, TTData(MOVE_NONE, VALUE_ZERO, VALUE_ZERO, DEPTH_ENTRY_OFFSET, BOUND_NONE, false, 0), TTWriter(replace));
+    return std::make_tuple(false, TTData(MOVE16_NONE, VALUE_ZERO, VALUE_ZERO, DEPTH_ENTRY_OFFSET, BOUND_NONE, false, 0), TTWriter(replace));
 }
\ No newline at end of file
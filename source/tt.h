@@ -33,10 +33,6 @@ static constexpr int GENERATION_CYCLE = 255 + GENERATION_DELTA;
 
 static constexpr int GENERATION_MASK = (0xFF << GENERATION_BITS) & 0xFF;
 
-// Move圧縮関数の宣言
-static inline uint16_t move_to16(Move m);
-static inline Move move_from16(uint16_t m16);
-
 // 置換表エントリ数
 #define TT_ENTRY_NB 5
 
@@ -63,7 +59,7 @@ static inline Move move_from16(uint16_t m16);
 // 置換表エントリに格納するデータ構造体
 // 読み取り専用で、TTEntryから取得したデータを保持する
 struct TTData {
-    Move   move;       // この局面での最善手
+    Move16 move;       // この局面での最善手(16bit形式。Position::reconstruct_move()でMoveに戻す)
     Value  value;      // この局面での探索結果の評価値
     Value  eval;       // この局面での静的評価値（評価関数の直接値）
     Depth  depth;      // この値を得た時の探索深さ
@@ -75,7 +71,7 @@ struct TTData {
     TTData() = delete;
 
     // コンストラクタ：各値を明示的に設定
-    TTData(Move m, Value v, Value ev, Depth d, Bound b, bool pv, uint8_t g) :
+    TTData(Move16 m, Value v, Value ev, Depth d, Bound b, bool pv, uint8_t g) :
         move(m),      // 最善手
         value(v),    // 探索値
         eval(ev),    // 静的評価値
@@ -107,7 +103,7 @@ struct TTData {
 class TTWriter {
 public:
     // 指定されたパラメータでTTEntryを更新する
-    inline void write(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8);
+    inline void write(Key k, Value v, bool pv, Bound b, Depth d, Move16 m, Value ev, uint8_t generation8);
 
     // デフォルトコンストラクタ：未使用状態を示す
     TTWriter() : entry(nullptr) {}
@@ -129,68 +125,6 @@ private:
     TTWriter(struct TTEntry* tte) : entry(tte) {}
 };
 
-// ■ Move圧縮関数 move_to16() の解説
-//
-// 32bitのMove情報を16bitに効率的に圧縮する。
-// 5五将棋の盤面特性（25升）を活かして最小のbit数で表現。
-//
-// 【5五将棋におけるMoveのbit配分】
-// bit 15-11: from (0-24) + 1 = 1-25 (5bit)
-// bit 10-6 :  to   (0-24) + 1 = 1-25 (5bit)
-// bit 5     :  promotion (0-1)           (1bit)
-// bit 4     :  is_drop   (0-1)           (1bit)
-// bit 3-0   :  piece_type (0-6)          (4bit, 実際は3bit使用）
-//
-// 【設計思想】
-// ・通常の指し手: from(5) + to(5) + promote(1) + 0(1) = 11bit
-// ・駒打ち:       0(5) + to(5) + 0(1) + 1(1) + piece(3) = 10bit
-// ・合計で最大15bitを使用するので16bitに余裕を持って収まる
-//
-// 【利点】
-// ・メモリ使用量を半減できる（32bit→16bit）
-// ・キャッシュ効率が向上する（より多くのエントリがL1キャッシュに収まる）
-//
-static inline uint16_t move_to16(Move m) {
-    // 特殊な指し手は0として表現
-    if (m == MOVE_NONE || m == MOVE_NULL || m == MOVE_RESIGN)
-        return 0;
-
-    // 各フィールドを抽出してビットシフトで配置
-    uint16_t from = is_drop(m) ? 0 : (move_from(m) + 1);      // 移動元（0は駒打ち用）
-    uint16_t to = move_to(m) + 1;                            // 移動先（1-25の範囲）
-    uint16_t promote = is_promote(m) ? 1 : 0;                  // 成りフラグ
-    uint16_t drop = is_drop(m) ? 1 : 0;                         // 打ち駒フラグ
-    uint16_t dropped_piece = drop ? (move_dropped_piece(m) - PAWN + 1) : 0;  // 駒種
-
-    // ビットフィールドを結合して16bitに圧縮
-    return (from << 11) | (to << 6) | (promote << 5) | (drop << 4) | dropped_piece;
-}
-
-static inline Move move_from16(uint16_t m16) {
-    if (m16 == 0)
-        return MOVE_NONE;
-
-    uint16_t from = (m16 >> 11) & 0x1f;
-    uint16_t to = (m16 >> 6) & 0x1f;
-    uint16_t promote = (m16 >> 5) & 1;
-    uint16_t drop = (m16 >> 4) & 1;
-    uint16_t dropped_piece = m16 & 0xf;
-
-    if (drop) {
-        // 駒打ち
-        Piece pt = Piece(dropped_piece - 1 + PAWN);
-        return make_move_drop(pt, Square(to - 1));
-    } else {
-        // 通常の移動
-        Square from_sq = Square(from - 1);
-        Square to_sq = Square(to - 1);
-        if (promote)
-            return make_move_promote(from_sq, to_sq);
-        else
-            return make_move(from_sq, to_sq);
-    }
-}
-
 // ■ TTEntry構造体の解説
 //
 // 置換表の個々のエントリを表現する構造体。
@@ -198,14 +132,14 @@ static inline Move move_from16(uint16_t m16) {
 //
 // 【メモリレイアウト（16bytes合計）
 // key32        : 4bytes - 局面ハッシュの上位32bit
-// move16       : 2bytes - 圧縮された最善手
+// move16       : 2bytes - 最善手(16bit形式)
 // value16      : 2bytes - 探索結果の評価値
 // eval16       : 2bytes - 静的評価値
 // depth8       : 1bytes - 探索深さ（0-63）
 // genBound8    : 1bytes - 世代(7bit) + PVフラグ(1bit)
 //
 // 【圧縮技術】
-// ・Moveの16bit圧縮：from(5bit) + to(5bit) + 成り(1bit) + 打ち(1bit) + 駒種(3bit)
+// ・Moveは移動させる駒を除いた16bit形式(Move16)で持つ
 // ・Depthの6bit圧縮：5五将棋では深さ63で十分
 // ・世代管理：7bitで128世代まで管理可能
 //
@@ -216,9 +150,8 @@ struct TTEntry {
     uint32_t key32;
 
     // 【最善手：2bytes】
-    // 16bitに圧縮された指し手情報。
-    // 詳細はmove_to16()/move_from16()関数を参照。
-    uint16_t move16;
+    // 16bit形式の指し手。移動させる駒は局面から復元する。
+    Move16 move16;
 
     // 【探索値：2bytes】
     // Alpha-beta探索で得た評価値。
@@ -240,8 +173,8 @@ struct TTEntry {
 
     // --- アクセスメソッド群 ---
 
-    // 16bit圧縮されたMoveを復元して返す
-    Move move() const;
+    // 保存されている指し手(16bit形式)を返す
+    Move16 move() const;
 
     // 保存されている探索値をValue型に変換して返す
     Value value() const;
@@ -269,7 +202,7 @@ struct TTEntry {
 
     // 指定されたデータをこのエントリに保存する
     // 引数：ハッシュ上位32bit, 探索値, PVフラグ, Bound, 深さ, 指し手, 評価値, 世代
-    inline void save(uint32_t k32, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t g8);
+    inline void save(uint32_t k32, Value v, bool pv, Bound b, Depth d, Move16 m, Value ev, uint8_t g8);
 
     // このエントリが未使用かどうかを判定
     // depth8が0なら空とみなす
@@ -330,11 +263,11 @@ public:
     TranspositionTable();
     ~TranspositionTable();
 
-    // 置換表のサイズを変更する[MB単位]
+    // 置換表のサイズを変更する[MB単位]。確保し直した内容は不定なので、clear()を呼び出すこと。
     inline void resize(size_t mbSize);
 
-    // 置換表をクリア
-    inline void clear();
+    // 置換表をクリア。スレッドプール(Threading::Pool)で分担してゼロクリアする。
+    void clear();
 
     // 置換表の使用率を1000分率で返す
     inline int hashfull() const;
@@ -391,14 +324,7 @@ void TranspositionTable::resize(size_t mbSize) {
         return;
     }
 
-    // 新しいテーブルをゼロクリア
-    clear();
-}
-
-void TranspositionTable::clear() {
-    if (table) {
-        std::memset(table, 0, sizeof(Cluster) * clusterCount);
-    }
+    // ゼロクリアは呼び出し側でclear()を呼び出して行う。(確保直後とisreadyのときとで二重にクリアしないように)
 }
 
 int TranspositionTable::hashfull() const {
@@ -480,7 +406,7 @@ TTData TTEntry::get_data() const {
     return TTData(move(), value(), eval(), depth(), bound(), is_pv(), generation());
 }
 
-void TTEntry::save(uint32_t k32, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t g8) {
+void TTEntry::save(uint32_t k32, Value v, bool pv, Bound b, Depth d, Move16 m, Value ev, uint8_t g8) {
     // relative_age(g8)は「このエントリが現在世代から何世代ずれているか」を返す。
     // 0   : 現在世代 (直近に更新された情報)
     // 1   : 1世代前
@@ -500,7 +426,7 @@ void TTEntry::save(uint32_t k32, Value v, bool pv, Bound b, Depth d, Move m, Val
     if (empty() || aged_out || shallow_old || b == BOUND_EXACT || k32 != key32 ||
         d - DEPTH_ENTRY_OFFSET + 2 * pv > depth8 - 4) {
         key32 = k32;
-        move16 = move_to16(m);
+        move16 = m;
         value16 = int16_t(v);
         eval16 = int16_t(ev);
         depth8 = uint8_t(d & 0x3f);
@@ -514,7 +440,7 @@ void TTEntry::save(uint32_t k32, Value v, bool pv, Bound b, Depth d, Move m, Val
 }
 
 // TTWriterのinlineメソッド実装
-void TTWriter::write(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8) {
+void TTWriter::write(Key k, Value v, bool pv, Bound b, Depth d, Move16 m, Value ev, uint8_t generation8) {
     // debug
     // std::cout << "TT書き込み key=" << std::hex << k << std::dec
     //           << " value=" << v
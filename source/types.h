@@ -720,6 +720,27 @@ static std::ostream &operator<<(std::ostream &os, Move m) {
   return os;
 }
 
+// --------------------
+//   16bit形式の指し手
+// --------------------
+
+// Moveの下位16bit(移動先・移動元・駒打ち・成り)だけを取り出した指し手。
+// 移動させる駒(Moveの上位16bit)を持たないので半分の大きさで済む。
+// 置換表、killer、history、読み筋など、指し手をたくさん保持するところではこちらを用いる。
+// Moveに戻すときは、局面から駒を補うPosition::reconstruct_move()を用いる。
+enum Move16 : uint16_t {
+  MOVE16_NONE = 0,
+};
+
+// Moveを16bit形式にする。MOVE_NONEはMOVE16_NONEになる。
+constexpr Move16 to_move16(Move m) { return Move16(m & 0xffff); }
+
+// USI形式で指し手を表示する。USI形式の文字列には移動させる駒が不要なので、そのままMoveとして出力できる。
+static std::ostream &operator<<(std::ostream &os, Move16 m) {
+  os << to_usi_string(Move(m));
+  return os;
+}
+
 // --------------------
 //   拡張された指し手
 // --------------------
@@ -845,8 +866,19 @@ std::ostream &operator<<(std::ostream &os, Hand hand);
 //    指し手生成器
 // --------------------
 
-// 局面の合法手の最大数
-constexpr int MAX_MOVES = 600;
+// 局面の(pseudo-legalを含む)指し手の最大数
+// 5五将棋の駒は玉・飛・角・銀・金・歩が2枚ずつで、駒を取れば同じ種類の駒を2枚とも持てる。
+// 手番側の指し手は次のように上から抑えられる。(成/不成の両方を生成する*_ALLの指し手生成も含む)
+//   盤上の駒1枚 : 空の盤での、成/不成を別に数えた指し手の数の最大。(他の駒があれば減るだけ)
+//                 玉8、飛16(敵陣の段で横に8升 x 2)、角10(中央から8升、うち敵陣の2升 x 2)、銀8(2段目から前3升 x 2 + 後ろ2升)、
+//                 金・成駒6、竜12、馬12。不成の駒と成駒の大きいほうをとると、飛16、角12、銀8、金6、歩6(と)。
+//   駒打ち      : 手駒の種類ごとに空き升の数以下。空き升は25 - 両玉 - 自分の盤上の駒(玉以外)以下。
+//                 同じ種類の2枚目を手駒に持っても、打つ指し手は増えない。
+// 盤上に置く自分の駒(玉以外)の数をk、手駒の種類の数をhとすると、指し手は 8 + (盤上の駒の指し手の和) + h x (23 - k) 以下。
+// 5種類それぞれについて、盤上と手駒に置く枚数(0～2)の組み合わせをすべて調べると、
+// 5種類を1枚ずつ盤上と手駒に置いたときの 8 + (16 + 12 + 8 + 6 + 6) + 5 x 18 = 146 が最大。
+// これに余裕を持たせておく。(ランダムな対局の1700万局面での最大は135手だった)
+constexpr int MAX_MOVES = 151;
 
 // 生成する指し手の種類
 enum MOVE_GEN_TYPE {
@@ -868,8 +900,8 @@ enum MOVE_GEN_TYPE {
   NON_EVASIONS, // 王手の回避ではない手(指し手生成元で王手されていない局面であることがわかっているときのすべての指し手)
   NON_EVASIONS_ALL, // NON_EVASIONS + 歩の不成などを含む。
 
-  // 以下の2つは、pos.legalを内部的に呼び出すので生成するのに時間が少しかかる。棋譜の読み込み時などにしか使わない。
-  LEGAL, // 合法手すべて。ただし、角・飛の不成は生成しない。
+  // 以下の2つは、pinと玉の移動先を考慮して合法手だけを生成する。(pos.legalでのチェックは不要)
+  LEGAL, // 合法手すべて。ただし、角・飛の不成は生成しない。(成りに劣る指し手なので探索ではこちらを用いる)
   LEGAL_ALL, // 合法手すべて
 
   CHECKS,     // 王手となる指し手(歩の不成などは含まない)
@@ -902,11 +934,14 @@ template <MOVE_GEN_TYPE GenType> struct MoveList {
   // lastは内部のバッファを指しているので、このクラスのコピーは不可。
 
   explicit MoveList(const Position &pos)
-      : last(generateMoves<GenType>(pos, mlist)) {}
+      : last(generateMoves<GenType>(pos, mlist)) {
+    ASSERT_LV3(size() <= MAX_MOVES);
+  }
 
   explicit MoveList(const Position& pos, Square sq)
    : last(generateMoves<GenType>(pos, mlist, sq)) {
     static_assert(GenType == RECAPTURES || GenType == RECAPTURES_ALL);
+    ASSERT_LV3(size() <= MAX_MOVES);
   }
   
   // 内部的に持っている指し手生成バッファの先頭
@@ -920,7 +955,7 @@ template <MOVE_GEN_TYPE GenType> struct MoveList {
 
   // i番目の要素を返す
   const ExtMove at(size_t i) const {
-    ASSERT_LV3(0 <= i && i < size());
+    ASSERT_LV3(i < size());
     return begin()[i];
   }
 
@@ -1,6 +1,8 @@
 ﻿#include "usi.h"
 #include "evaluate.h"
+#include "kpp.h"
 #include "misc.h"
+#include "nnue.h"
 #include "search.h"
 #include "tt.h"
 
@@ -13,10 +15,196 @@ using namespace std;
 
 void random_player_cmd(Position &pos, istringstream &is);
 void user_test(Position &pos, istringstream &is);
+void bench_cmd(Position &pos, istringstream &is);
+void perft_cmd(Position &pos, istringstream &is);
+void tune_cmd(Position &pos, istringstream &is);
+
+// USIのoption設定
+USI::OptionsMap Options;
+
+// ----------------------------------
+//      USI option
+// ----------------------------------
+
+bool USI::CaseInsensitiveLess::operator()(const string &s1, const string &s2) const {
+  return lexicographical_compare(s1.begin(), s1.end(), s2.begin(), s2.end(),
+                                 [](char c1, char c2) { return tolower(c1) < tolower(c2); });
+}
+
+// optionの初期化。ここで登録したoptionが"usi"コマンドに対して出力される。
+void USI::init(OptionsMap &o) {
+  // 探索に用いるスレッドの数(goコマンドを処理するスレッドを含む)。isreadyのときにスレッドプールを作り直す。
+  // perftや置換表のクリアなども、この数のスレッドで行う。
+  o["Threads"] << Option(int(std::max(1u, std::thread::hardware_concurrency())), 1, 512);
+
+  // 複数のスレッドでの探索の方法。Threadsが1なら、どれを選んでも1スレッドで探索する。
+  //   Off       : goコマンドを処理するスレッドだけで探索する。
+  //   LazySMP   : 全スレッドが同じ局面を反復深化で探索し、置換表を介して結果を共有する。
+  //   RootSplit : rootの指し手をスレッドで分け合って探索する。
+  //   ABDADA    : LazySMPと同様に全スレッドが同じ局面を探索するが、他のスレッドが探索中の子nodeは後回しにする。
+  o["ParallelMode"] << Option({"Off", "LazySMP", "RootSplit", "ABDADA"}, "Off");
+
+  // 詰み探索専用スレッドの数。0なら詰み探索スレッドを起動しない。
+  o["MateThreads"] << Option(1, 0, 8);
+
+  // スレッドプールのワーカーを論理コアに固定するか。(Linuxのみ) isreadyのときに反映する。
+  o["ThreadAffinity"] << Option(false);
+
+  // ThreadAffinityで固定する論理コアの起点。プロセスが使える論理コアのうち、この番号の次から順にワーカーを固定する。
+  // 同じマシンで複数のエンジンを動かすときは、それぞれ重ならないように設定すること。
+  o["ThreadAffinityBase"] << Option(0, 0, 1023);
+
+  // 詰み探索の最大手数。0なら持ち時間から自動で決める。
+  o["MateDepth"] << Option(0, 0, 31);
+
+  // 評価関数のパラメーターファイル。"<internal>"なら組み込みのパラメーターを用いる。isreadyのときに読み込む。
+  o["EvalFile"] << Option("<internal>");
+
+#if defined(USE_EVAL_HASH)
+  // 評価値のキャッシュ(EvalHash)のサイズ[MB]。0ならキャッシュしない。isreadyのときに確保する。
+  o["EvalHash"] << Option(DEFAULT_EVAL_HASH_SIZE, 0, 1024);
+#endif
+
+#if defined(USE_EVAL_TABLE_CACHE)
+  // KKPEEのキャッシュファイル(約5.9MB)を置くディレクトリ。"<none>"ならキャッシュしない。
+  // 作業ディレクトリ(GUIのものであることが多い)に勝手に書き込まないように、指定されたときだけキャッシュする。
+  o["EvalCacheDir"] << Option("<none>");
+#endif
+
+#if defined(EVAL_NNUE)
+  // NNUE評価関数を用いるか。falseなら従来の評価関数(KKPEE)を用いる。
+  o["UseNNUE"] << Option(false);
+
+  // NNUE評価関数の重みファイル。isreadyのときに読み込む。
+  o["NNUEFile"] << Option("nn.bin");
+#endif
+
+#if defined(EVAL_KPP)
+  // KKP + KPP評価関数を用いるか。
+  o["UseKPP"] << Option(false);
+
+  // KKP + KPP評価関数のテーブルファイル。isreadyのときに読み込む。
+  o["KPPFile"] << Option("kpp.bin");
+#endif
+}
+
+USI::Option::Option(int v, int minv, int maxv, OnChange f)
+    : type("spin"), min(minv), max(maxv), on_change(f) {
+  defaultValue = currentValue = std::to_string(v);
+}
+
+USI::Option::Option(bool v, OnChange f) : type("check"), min(0), max(0), on_change(f) {
+  defaultValue = currentValue = (v ? "true" : "false");
+}
+
+USI::Option::Option(const char *v, OnChange f) : type("string"), min(0), max(0), on_change(f) {
+  defaultValue = currentValue = v;
+}
+
+USI::Option::Option(const std::vector<std::string> &list, const char *v, OnChange f)
+    : type("combo"), min(0), max(0), comboValues(list), on_change(f) {
+  ASSERT_LV1(std::find(list.begin(), list.end(), v) != list.end());
+  defaultValue = currentValue = v;
+}
+
+void USI::Option::operator<<(const Option &o) {
+  static size_t insert_order = 0;
+  *this = o;
+  idx = insert_order++;
+}
+
+USI::Option &USI::Option::operator=(const string &v) {
+  ASSERT_LV1(!type.empty());
+
+  if ((type != "button" && v.empty()) ||
+      (type == "check" && v != "true" && v != "false") ||
+      (type == "spin" && (stoi(v) < min || stoi(v) > max)) ||
+      (type == "combo" && std::find(comboValues.begin(), comboValues.end(), v) == comboValues.end()))
+    return *this;
+
+  if (type != "button")
+    currentValue = v;
+
+  if (on_change)
+    on_change(*this);
+
+  return *this;
+}
+
+USI::Option::operator int() const {
+  ASSERT_LV1(type == "check" || type == "spin");
+  return (type == "spin" ? stoi(currentValue) : currentValue == "true");
+}
+
+USI::Option::operator string() const {
+  ASSERT_LV1(type == "string" || type == "combo");
+  return currentValue;
+}
+
+std::ostream &USI::operator<<(std::ostream &os, const OptionsMap &om) {
+  // 登録順に出力する
+  for (size_t idx = 0; idx < om.size(); ++idx)
+    for (const auto &it : om)
+      if (it.second.idx == idx) {
+        const Option &o = it.second;
+        os << "option name " << it.first << " type " << o.type;
+
+        if (o.type != "button")
+          os << " default " << o.defaultValue;
+
+        if (o.type == "spin")
+          os << " min " << o.min << " max " << o.max;
+
+        for (const auto &v : o.comboValues)
+          os << " var " << v;
+
+        os << endl;
+        break;
+      }
+
+  return os;
+}
+
+// setoptionコマンド
+// "setoption name [option名] value [値]"の形式で送られてくる。
+void setoption_cmd(istringstream &is) {
+  string token, name, value;
+
+  // "name"
+  is >> token;
+
+  // option名にはスペースが含まれることがある。
+  while (is >> token && token != "value")
+    name += (name.empty() ? "" : " ") + token;
+
+  while (is >> token)
+    value += (value.empty() ? "" : " ") + token;
+
+  if (Options.count(name))
+    Options[name] = value;
+  else
+    cout << "info string Error! : No such option: " << name << endl;
+}
 
 void is_ready_cmd(Position &pos, StateListPtr &states) {
   // --- 初期化
 
+  // 評価関数のパラメーターの読み込み
+  Eval::load_eval();
+
+#if defined(EVAL_NNUE)
+  // 評価関数の重みの読み込み
+  Eval::NNUE::load_eval();
+#endif
+#if defined(EVAL_KPP)
+  Eval::KPP::load_eval();
+#endif
+
+#if defined(USE_EVAL_HASH)
+  // 評価関数が切り替わっているかもしれないので、EvalHashは確保し直してクリアする。
+  Eval::resize_eval_hash(size_t((int)Options["EvalHash"]));
+#endif
+
   Search::clear();
   Search::Stop = false;
 
@@ -109,6 +297,17 @@ void go_cmd(const Position &pos, istringstream &is, StateListPtr &states) {
   Search::start_thinking(pos, states, limits);
 }
 
+// position・goコマンドを受け取ったときに、スレッドプールのワーカーを眠らせずに待たせる時間。
+// 通常はpositionの直後にgoが来るので、その間と探索の開始を覆えれば十分。
+constexpr auto PREWAKE_WINDOW = std::chrono::milliseconds(200);
+
+// 探索がスレッドプールを用いるときだけ、眠っているワーカーを先に起こしておく。
+// ParallelModeがOffなら探索はプールに仕事を渡さないので、起こすと待っている間のCPUを無駄に使う。(相手のエンジンやGUIのCPUを奪う)
+void prewake_workers() {
+  if ((int)Options["Threads"] > 1 && std::string(Options["ParallelMode"]) != "Off")
+    Threading::Pool.prewake(PREWAKE_WINDOW);
+}
+
 void USI::loop(int argc, char *argv[]) {
   // 探索開始局面(root)を格納するPositionクラス
   Position pos;
@@ -159,13 +358,21 @@ void USI::loop(int argc, char *argv[]) {
     is >> skipws >> token;
 
     if (token == "usi")
-      cout << engine_info() << "usiok" << endl;
+      cout << engine_info() << Options << "usiok" << endl;
+
+    else if (token == "setoption")
+      setoption_cmd(is);
 
-    else if (token == "go")
+    else if (token == "go") {
+      prewake_workers();
       go_cmd(pos, is, states);
+    }
 
-    else if (token == "position")
+    else if (token == "position") {
+      // まもなくgoコマンドが来るので、眠っているワーカーを先に起こしておく。
+      prewake_workers();
       position_cmd(pos, is, states);
+    }
 
     else if (token == "usinewgame")
       continue;
@@ -181,8 +388,10 @@ void USI::loop(int argc, char *argv[]) {
       cout << pos << endl;
 
     // 現在の局面について評価関数を呼び出して、その値を返す。
-    else if (token == "eval")
+    else if (token == "eval") {
+      Eval::load_eval();
       cout << "eval = " << Eval::evaluate(pos) << endl;
+    }
 
     else if (token == "compiler")
       cout << compiler_info() << endl;
@@ -217,6 +426,22 @@ void USI::loop(int argc, char *argv[]) {
     else if (token == "user")
       user_test(pos, is);
 
+    // 直前の探索の統計(USE_SEARCH_STATS)
+    else if (token == "searchstats")
+      Search::print_stats();
+
+    // 評価関数と探索の速度計測
+    else if (token == "bench")
+      bench_cmd(pos, is);
+
+    // 指し手生成の検証(perft)
+    else if (token == "perft")
+      perft_cmd(pos, is);
+
+    // 棋譜から評価関数のパラメーターを調整する
+    else if (token == "tune")
+      tune_cmd(pos, is);
+
     else {
       if (!token.empty())
         cout << "No such option: " << token << endl;
@@ -230,7 +455,7 @@ std::string USI::pv(const Position &pos, int depth) {
   TimePoint elapsed = Time.elapsed() + 1;
 
   const auto &rootMoves = Search::rootMoves;
-  uint64_t nodes_searched = Search::Nodes;
+  uint64_t nodes_searched = Search::nodes_searched();
 
   // rootMovesが空の場合は何も出力しない
   if (rootMoves.empty())
@@ -307,6 +532,8 @@ std::string USI::move(Move m) {
   return ss.str();
 }
 
+std::string USI::move(Move16 m) { return USI::move(Move(m)); }
+
 Move USI::to_move(const Position &pos, const std::string &str) {
   if (str == "resign")
     return MOVE_RESIGN;
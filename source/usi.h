@@ -3,9 +3,64 @@
 
 #include "types.h"
 
+#include <map>
+#include <vector>
+
 class Position;
 
 namespace USI {
+class Option;
+
+// option名の比較で大文字と小文字を区別しないための比較関数
+struct CaseInsensitiveLess {
+  bool operator()(const std::string &, const std::string &) const;
+};
+
+// USIのoption名と値を保持しておくmap
+typedef std::map<std::string, Option, CaseInsensitiveLess> OptionsMap;
+
+// USIプロトコルで指定されるoptionの1つ分
+class Option {
+  // 値が変更されたときに呼び出されるハンドラ
+  typedef void (*OnChange)(const Option &);
+
+public:
+  // spin型
+  Option(int v, int minv, int maxv, OnChange f = nullptr);
+  // check型
+  Option(bool v, OnChange f = nullptr);
+  // string型
+  Option(const char *v, OnChange f = nullptr);
+  // combo型。vはlistのいずれかであること。
+  Option(const std::vector<std::string> &list, const char *v, OnChange f = nullptr);
+  Option(OnChange f = nullptr) : type("button"), min(0), max(0), on_change(f) {}
+
+  // setoptionで値が設定されたときに呼び出される。範囲外の値などは無視される。
+  Option &operator=(const std::string &v);
+
+  // 起動時に各optionを登録するときに用いる。登録順を記録しておき、その順で"usi"に応答する。
+  void operator<<(const Option &o);
+
+  // 現在の値を返す
+  operator int() const;
+  operator std::string() const;
+
+private:
+  friend std::ostream &operator<<(std::ostream &os, const OptionsMap &om);
+
+  std::string defaultValue, currentValue, type;
+  int min, max;
+  std::vector<std::string> comboValues;
+  size_t idx = 0;
+  OnChange on_change;
+};
+
+// optionの初期化。起動時に呼び出される。
+void init(OptionsMap &o);
+
+// "usi"コマンドに対してoption一覧を出力する。
+std::ostream &operator<<(std::ostream &os, const OptionsMap &om);
+
 // USIメッセージ応答部(起動時に、各種初期化のあとに呼び出される)
 void loop(int argc, char *argv[]);
 
@@ -16,6 +71,7 @@ std::string value(Value v);
 
 // 指し手をUSI文字列に変換する。
 std::string move(Move m /*, bool chess960*/);
+std::string move(Move16 m);
 
 // pv(読み筋)をUSIプロトコルに基いて出力する。
 // depth : 反復深化のiteration深さ。
@@ -27,6 +83,9 @@ std::string pv(const Position &pos, int depth);
 Move to_move(const Position &pos, const std::string &str);
 } // namespace USI
 
+// USIのoption設定はここに保持されている。
+extern USI::OptionsMap Options;
+
 // 外部からis_ready_cmd()を呼び出す。
 // 局面は初期化されない。
 void is_ready();